@@ -0,0 +1,154 @@
+/* app.c
+**
+** Top level of the firmware: device setup and the main loop
+** body.
+*/
+
+#include "hal.h"
+#include "d2a.h"
+#include "timer2.h"
+#include "notes.h"
+#include "serial.h"
+#include "segment.h"
+#include "led.h"
+#include "playback.h"
+#include "bench.h"
+#include "audio.h"
+#include "sched.h"
+#include "keys.h"
+#include "cmd.h"
+#include "stream.h"
+#include "midi.h"
+#include "store.h"
+#include "tempo.h"
+#include "voice.h"
+#include "power.h"
+#include "app.h"
+
+/* Register a task, reporting one that doesn't fit in the table
+*/
+static void add_task(task_fn fn, PGM_P name, uint16_t period, uint8_t priority)
+{
+	if (sched_add(fn, name, period, priority) == 255) {
+		output_string_P(PSTR("\r\n-TaskTableFull:"));
+		output_string_P(name);
+		output_string_P(PSTR("- "));
+	}
+}
+
+void app_setup(void)
+{
+	/* Setup timer 2 to generate an interrupt every 1ms
+	** for push button checks and other timer actions
+	*/
+	setup_timer2();
+	
+	/* Setup the note timer so that we are ready to 
+	** generate sounds
+	*/
+	setup_note_timer();
+	
+	/* Configure the D2A so we're ready to output 
+	** data to the speaker
+	*/
+	setup_d2a();
+	
+	/* Configure serial port ready for In/Out
+	*/
+	setup_serial();
+	
+	/* Print the splash screen message
+	*/
+	output_string_P(PSTR("\r\nReady 42345493 Chris Ponticello "));
+	
+	/* Configure the 7SEG port for In/Out
+	*/
+	setup_segmentDisplay();
+	
+	/* Configure the onboard LED
+	*/
+	setup_led();
+	
+	/* Start the free-running cycle counter used by
+	** the serial benchmark command
+	*/
+	setup_cycle_counter();
+	
+	/* Switch off unused peripherals, ready for idle sleep
+	*/
+	setup_power();
+	
+	/* The LED and the sequencer follow the beat clock
+	*/
+	tempo_subscribe(led_tick);
+	tempo_subscribe(playback_tick);
+	
+	/* Register the regular tasks, highest priority first.
+	** Each runs from the main loop when due (sched.h).
+	*/
+	add_task(keys_scan, PSTR("keys"), 1, 3);
+	add_task(voice_env_step, PSTR("env"), 1, 2);
+	add_task(tempo_step, PSTR("beat"), 1, 2);
+	add_task(playbackStep, PSTR("play"), 1, 2);
+	add_task(stream_tick, PSTR("strm"), 1, 2);
+	add_task(segmentRefresh, PSTR("disp"), SEGMENT_REFRESH_MS, 1);
+	add_task(segment_scroll_step, PSTR("scrl"), SEGMENT_SCROLL_MS, 0);
+	add_task(power_tick, PSTR("pwr"), POWER_TICK_MS, 0);
+	
+	/* Bring back the last session's recording from EEPROM
+	*/
+	store_restore();
+	
+	/* Fill the sample FIFO before the note timer starts
+	** draining it
+	*/
+	audio_render_poll();
+}
+
+/* Set when the last pass ran a task, which may have left
+** work for the next (e.g. key events)
+*/
+static uint8_t taskRan = 0;
+
+void app_poll(void)
+{
+	/* Render audio ahead of the note timer interrupt, act
+	** on any key events, MIDI events, serial commands and
+	** finished EEPROM saves, then run at most one due task
+	** so that a slow task can't starve the audio.
+	*/
+	audio_render_poll();
+	handleKeyEvents();
+	midi_poll();
+	cmd_poll();
+	store_poll();
+	taskRan = sched_run();
+}
+
+/* Nonzero if there is main loop work left to do
+*/
+static uint8_t app_busy(void)
+{
+	return taskRan || audio_pending() || sched_pending() || serial_rx_pending() ||
+		midi_pending() || store_pending();
+}
+
+void app_idle(void)
+{
+	/* Check for work with interrupts off, so that anything an
+	** interrupt brings from now on wakes the sleep at once
+	*/
+	cli();
+	if (app_busy()) {
+		sei();
+		return;
+	}
+	power_sleep();
+}
+
+void app_drain(void)
+{
+	do {
+		app_poll();
+	} while (app_busy());
+}
@@ -0,0 +1,30 @@
+/* app.h
+**
+** Top level of the firmware: device setup and the main loop
+** body. main() (main.c) calls app_setup() once, enables
+** interrupts and then calls app_poll() and app_idle() forever;
+** host programs run the same loop (app_drain()) around the
+** virtual MCU in host/hal_host.c.
+*/
+
+#ifndef APP_H
+#define APP_H
+
+/* Configure every device and print the splash screen */
+void app_setup(void);
+
+/* One iteration of the main loop */
+void app_poll(void);
+
+/* Sleep until the next interrupt if app_poll() left nothing to
+** do (power.h)
+*/
+void app_idle(void);
+
+/* Run app_poll() until it leaves nothing to do, as the main loop
+** does between sleeps. Host programs pass this to hal_host_run(),
+** which only returns control after an interrupt.
+*/
+void app_drain(void);
+
+#endif
@@ -0,0 +1,145 @@
+/* audio.c
+**
+** Audio output pipeline: block rendering into the sample
+** FIFO, and the note timer ISR that drains it.
+*/
+
+#include "hal.h"
+#include "d2a.h"
+#include "notes.h"
+#include "audio.h"
+#include "profile.h"
+#include "power.h"
+#include "stream.h"
+#include "voice.h"
+
+/* Sample FIFO. The indices run freely over 0..255 and are
+** masked on access, so head-tail is the fill level. Only the
+** main loop writes audio_head and only the ISR writes
+** audio_tail; both are single bytes, so reads are atomic.
+*/
+static uint16_t audio_fifo[AUDIO_FIFO_SIZE];
+static volatile uint8_t audio_head = 0;
+static volatile uint8_t audio_tail = 0;
+static uint16_t audio_last = D2A_MIDSCALE;
+
+volatile uint8_t audio_gated = 0;
+
+/* Silent blocks rendered in a row. More than the FIFO target
+** means all the samples queued, and the last one sent, are
+** silence.
+*/
+static uint8_t silentBlocks = 0;
+#define AUDIO_GATE_BLOCKS (AUDIO_FIFO_TARGET/AUDIO_BLOCK + 1)
+
+volatile uint16_t audio_underruns = 0;
+volatile uint8_t audio_fifo_high = 0;
+
+
+void audio_render_poll(void) {
+	
+	uint8_t fill;
+	
+	while ((uint8_t)(audio_head - audio_tail) <= AUDIO_FIFO_TARGET-AUDIO_BLOCK) {
+		
+		/* audio_head is always block aligned, so the block can
+		** be rendered in place
+		*/
+		if (stream_active) {
+			stream_render(&audio_fifo[audio_head & AUDIO_FIFO_MASK], AUDIO_BLOCK);
+			silentBlocks = 0;
+		} else {
+			if (voice_count() != 0) {
+				silentBlocks = 0;
+			} else if (silentBlocks < AUDIO_GATE_BLOCKS) {
+				silentBlocks++;
+			}
+			synth_render(&audio_fifo[audio_head & AUDIO_FIFO_MASK], AUDIO_BLOCK);
+		}
+		audio_head += AUDIO_BLOCK;
+		
+		fill = audio_head - audio_tail;
+		if (fill > audio_fifo_high) {
+			audio_fifo_high = fill;
+		}
+	}
+	
+	/* Switch off for silence, after the last frame */
+	if ((silentBlocks == AUDIO_GATE_BLOCKS) && !audio_gated) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			hal_audio_timer_stop();
+			d2a_finish();
+			hal_spi_disable();
+			audio_gated = 1;
+		}
+	}
+}
+
+
+void audio_wake(void) {
+	
+	if (!audio_gated) {
+		return;
+	}
+	/* Keep only one block of the queued silence, so the
+	** next block rendered plays as soon as it would have
+	** without the gating
+	*/
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if ((uint8_t)(audio_head - audio_tail) > AUDIO_BLOCK) {
+			audio_tail = audio_head - AUDIO_BLOCK;
+		}
+		hal_spi_enable();
+		hal_audio_timer_start();
+		audio_gated = 0;
+		silentBlocks = 0;
+	}
+}
+
+
+uint8_t audio_pending(void) {
+	return !audio_gated &&
+		((uint8_t)(audio_head - audio_tail) <= AUDIO_FIFO_TARGET-AUDIO_BLOCK);
+}
+
+
+uint8_t audio_level(void) {
+	return audio_head - audio_tail;
+}
+
+
+void audio_stats_reset(void) {
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		audio_underruns = 0;
+		audio_fifo_high = 0;
+	}
+}
+
+
+/* Interrupt service routine for our note timer.
+*/
+ISR(TIMER1_COMPA_vect)
+{
+	/* Output one sample. This interrupt handler is called at
+	** AUDIO_SAMPLE_RATE; synthesis happens in the main loop
+	** (see synth_render in notes.c). If the main loop has
+	** fallen behind, the last sample is held and the underrun
+	** counted.
+	*/
+	uint8_t tail = audio_tail;
+	
+	POWER_WAKE();
+	PROF_ENTER(PROF_TIMER1);
+	
+	if (tail != audio_head) {
+		audio_last = audio_fifo[tail & AUDIO_FIFO_MASK];
+		audio_tail = tail + 1;
+	} else {
+		audio_underruns++;
+	}
+	
+	d2a_output(audio_last);
+	
+	PROF_EXIT(PROF_TIMER1);
+}
@@ -0,0 +1,53 @@
+/* audio.h
+**
+** Audio output pipeline. The main loop renders blocks of
+** AUDIO_BLOCK samples into a sample FIFO; the note timer ISR
+** pops one sample per interrupt and sends it to the D2A.
+** There is a single producer (main loop) and a single
+** consumer (ISR), so the FIFO needs no locking.
+*/
+
+#ifndef AUDIO_H
+#define AUDIO_H
+
+/* FIFO size and block size must be powers of two, with the
+** FIFO a whole number of blocks. The main loop keeps at most
+** AUDIO_FIFO_TARGET samples queued, which bounds the added
+** latency to AUDIO_FIFO_TARGET/AUDIO_SAMPLE_RATE (~4ms).
+*/
+#define AUDIO_FIFO_SIZE 128
+#define AUDIO_FIFO_MASK (AUDIO_FIFO_SIZE-1)
+#define AUDIO_BLOCK 32
+#define AUDIO_FIFO_TARGET 64
+
+/* Nonzero while the audio path is switched off for silence.
+** Once no voice has sounded for a whole FIFO of samples, timer
+** 1 and the SPI are stopped, holding the D2A at mid scale;
+** audio_wake() starts them again before a voice sounds.
+*/
+extern volatile uint8_t audio_gated;
+
+/* Statistics */
+extern volatile uint16_t audio_underruns;	//ISR found the FIFO empty
+extern volatile uint8_t audio_fifo_high;	//most samples ever queued
+
+/* Render blocks until the FIFO holds AUDIO_FIFO_TARGET
+** samples. Call from the main loop.
+*/
+void audio_render_poll(void);
+
+/* Nonzero if the FIFO wants another block */
+uint8_t audio_pending(void);
+
+/* Restart the audio path if it is switched off - main loop,
+** before starting a voice or stream
+*/
+void audio_wake(void);
+
+/* Samples queued for the note timer ISR */
+uint8_t audio_level(void);
+
+/* Clear the statistics */
+void audio_stats_reset(void);
+
+#endif
@@ -0,0 +1,104 @@
+/* bench.c
+**
+** On-target benchmarks, reported over the serial port.
+*/
+
+#include "hal.h"
+#include "notes.h"
+#include "voice.h"
+#include "serial.h"
+#include "audio.h"
+#include "playback.h"
+#include "bench.h"
+
+#define BENCH_SAMPLES AUDIO_BLOCK
+
+static uint16_t benchBuf[BENCH_SAMPLES];
+
+/* Timer 3 counts the system clock with no prescaler and
+** no interrupts, so TCNT3 differences are cycle counts.
+*/
+void setup_cycle_counter(void) {
+	hal_cycles_setup();
+}
+
+
+/* Time synth_render() over one block with an increasing
+** number of voices, each mid-envelope so that the amplitude
+** multiply is included, against the cycles available per
+** sample. Then time one envelope step of every voice.
+** The current notes are stopped first; the pool is left
+** silent afterwards. Interrupts are held off only for the
+** timed calls, so the figures are the mixer's alone while the
+** tick, the audio and the serial port keep running between
+** them.
+*/
+void bench_voices(void) {
+	
+	uint8_t i, n;
+	uint16_t start, cycles;
+	
+	voice_all_off();
+	output_string_P(PSTR("\r\nMix cycles/sample (budget "));
+	output_number(F_CPU/AUDIO_SAMPLE_RATE);
+	output_string_P(PSTR("):"));
+	
+	for (n=0; n<=NUM_VOICES; n++) {
+		
+		/* n voices sounding on n different notes */
+		voice_all_off();
+		for (i=0; i<n; i++) {
+			voice_note_on(i);
+		}
+		
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			start = cycles_now();
+			synth_render(benchBuf, BENCH_SAMPLES);
+			cycles = cycles_now() - start;
+		}
+		
+		output_string_P(PSTR(" "));
+		output_number(n);
+		output_string_P(PSTR("v="));
+		output_number(cycles/BENCH_SAMPLES);
+	}
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		start = cycles_now();
+		voice_env_step();
+		cycles = cycles_now() - start;
+	}
+	output_string_P(PSTR(" env/ms="));
+	output_number(cycles);
+	
+	voice_all_off();
+}
+
+
+/* Playback ticks are timed as they run (playback.c), so that
+** the figures include the real event density of each track.
+*/
+void bench_tracks(void) {
+	
+	uint8_t n;
+	play_stat_t s;
+	
+	output_string_P(PSTR("\r\nTick cycles (tracks=avg/max):"));
+	for (n=1; n<=REC_TRACKS; n++) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			s = play_stats[n];
+			play_stats[n].ticks = 0;
+			play_stats[n].total = 0;
+			play_stats[n].max = 0;
+		}
+		if (s.ticks == 0) {
+			continue;
+		}
+		output_string_P(PSTR(" "));
+		output_number(n);
+		output_string_P(PSTR("="));
+		output_number(s.total / s.ticks);
+		output_string_P(PSTR("/"));
+		output_number(s.max);
+	}
+}
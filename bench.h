@@ -0,0 +1,28 @@
+/* bench.h
+**
+** On-target benchmarks, reported over the serial port.
+** Timer 3 is left free-running at the system clock so that
+** code can be timed in CPU cycles by reading TCNT3.
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Current cycle count (wraps every 65536 cycles) */
+#define cycles_now() hal_cycles()
+
+/* Start timer 3 counting system clocks */
+void setup_cycle_counter(void);
+
+/* Print the cycles per mixed sample for 0..NUM_VOICES
+** active voices with the current waveform, against the cycles
+** per sample available, and the cycles per envelope step.
+*/
+void bench_voices(void);
+
+/* Print the mean and most cycles per playback tick for each
+** number of tracks played since the last call, and clear them.
+*/
+void bench_tracks(void);
+
+#endif
@@ -0,0 +1,10 @@
+# Toolchain file for cross-compiling the firmware with avr-gcc
+set(CMAKE_SYSTEM_NAME Generic)
+set(CMAKE_SYSTEM_PROCESSOR avr)
+
+find_program(CMAKE_C_COMPILER avr-gcc)
+find_program(CMAKE_OBJCOPY avr-objcopy)
+find_program(AVR_SIZE avr-size)
+
+set(CMAKE_TRY_COMPILE_TARGET_TYPE STATIC_LIBRARY)
+set(CMAKE_FIND_ROOT_PATH_MODE_PROGRAM NEVER)
@@ -0,0 +1,879 @@
+/* cmd.c
+**
+** Serial command interpreter, run from the main loop.
+**
+** Received characters are collected into a line holding a command
+** word and an optional argument, e.g. "bpm 140", "wave sine",
+** "oct +1", "steps 12" or "play". The line runs when CR or LF
+** arrives. Commands are looked up in the commands[] table (case
+** insensitive), so a new command is one handler and one entry.
+**
+** The original single key commands (upper case letters, '<' and
+** '>') are entries in the same table. One typed at the start of
+** a line runs as soon as a space, CR or LF follows it; followed by
+** anything else it starts a word, so "Play" runs "play", not "P".
+*/
+
+#include "hal.h"
+#include "serial.h"
+#include "notes.h"
+#include "tuning.h"
+#include "tempo.h"
+#include "playback.h"
+#include "bench.h"
+#include "wavetable.h"
+#include "audio.h"
+#include "profile.h"
+#include "sched.h"
+#include "stream.h"
+#include "midi.h"
+#include "voice.h"
+#include "store.h"
+#include "power.h"
+#include "segment.h"
+#include "cmd.h"
+
+typedef void (*cmd_fn)(char* arg);
+
+typedef struct {
+	char name[CMD_NAME_SIZE];
+	cmd_fn fn;
+} cmd_t;
+
+/* The line being received */
+static char line[CMD_LINE_SIZE];
+static uint8_t lineLen = 0;
+static uint8_t lineOverflow = 0;
+
+/* Set while the line is one character that may be a single key */
+static uint8_t keyPending = 0;
+
+
+/* Parse a decimal number with an optional sign. Returns 0 if
+** the string is not entirely a number.
+*/
+static uint8_t parse_number(char* s, int16_t* n) {
+
+	uint8_t neg = 0;
+	int16_t v = 0;
+
+	if ((*s=='+') || (*s=='-')) {
+		neg = (*s=='-');
+		s++;
+	}
+	if (*s==0) {
+		return 0;
+	}
+	for (; *s; s++) {
+		if ((*s<'0') || (*s>'9') || (v>=1000)) {
+			return 0;
+		}
+		v = v*10 + (*s-'0');
+	}
+	*n = neg ? -v : v;
+	return 1;
+}
+
+static void bad_arg(void) {
+	output_string_P(PSTR("\r\n-BadArg- "));
+}
+
+
+/* Waveform commands */
+
+static void print_wave(void) {
+	output_string_P(PSTR("\r\n-Wave:"));
+	output_string_P(wavetable_name(waveform));
+	output_string_P(PSTR("- "));
+	segment_scroll_P(wavetable_name(waveform));
+}
+
+/* 'T': toggle triangle waveform */
+static void cmd_triangle(char* arg) {
+	if (recording==0) {
+		set_waveform(WAVE_TRIANGLE);
+	}
+}
+
+/* 'S': toggle sine waveform */
+static void cmd_sine(char* arg) {
+	if (recording==0) {
+		set_waveform(WAVE_SINE);
+	}
+}
+
+/* 'W': step through all wavetables */
+static void cmd_next_wave(char* arg) {
+	if (recording==0) {
+		set_waveform((waveform+1) % NUM_WAVES);
+		print_wave();
+	}
+}
+
+/* "wave [name|next]": select or show the waveform */
+static void cmd_wave(char* arg) {
+
+	uint8_t i;
+
+	if (*arg==0) {
+		print_wave();
+		return;
+	}
+	if (recording) {
+		return;
+	}
+	if (strcasecmp_P(arg, PSTR("next"))==0) {
+		cmd_next_wave(arg);
+		return;
+	}
+	for (i=0; i<NUM_WAVES; i++) {
+		if (strcasecmp_P(arg, wavetable_name(i))==0) {
+			if (waveform != i) {
+				set_waveform(i);
+			}
+			print_wave();
+			return;
+		}
+	}
+	bad_arg();
+}
+
+/* 'I' / "interp [on|off]": wavetable interpolation */
+static void cmd_interp(char* arg) {
+
+	if (*arg==0) {
+		waveInterpolate ^= 1;
+	} else if (strcasecmp_P(arg, PSTR("on"))==0) {
+		waveInterpolate = 1;
+	} else if (strcasecmp_P(arg, PSTR("off"))==0) {
+		waveInterpolate = 0;
+	} else {
+		bad_arg();
+		return;
+	}
+	if (waveInterpolate) {
+		output_string_P(PSTR("\r\n-InterpOn- "));
+	} else {
+		output_string_P(PSTR("\r\n-InterpOff- "));
+	}
+}
+
+/* '<': dec triangular waveform */
+static void cmd_steps_dec(char* arg) {
+	if (triWaveSteps>4) {
+		triWaveSteps--;
+	}
+}
+
+/* '>': inc triangular waveform */
+static void cmd_steps_inc(char* arg) {
+	if (triWaveSteps<16) {
+		triWaveSteps++;
+	}
+}
+
+/* "steps n": set triangular waveform steps, 4..16 */
+static void cmd_steps(char* arg) {
+
+	int16_t n;
+
+	if (!parse_number(arg, &n) || (n<4) || (n>16)) {
+		bad_arg();
+		return;
+	}
+	triWaveSteps = n;
+}
+
+/* 'U': toggle double wavelength */
+static void cmd_octave_toggle(char* arg) {
+	if (recording==0) {
+		octave ^= 1;
+		output_string_P(PSTR("\r\n-OctaveToggle- "));
+	}
+}
+
+/* "oct n|+n|-n": set the octave, or move it up/down */
+static void cmd_oct(char* arg) {
+
+	int16_t n;
+
+	if (!parse_number(arg, &n)) {
+		bad_arg();
+		return;
+	}
+	if (recording) {
+		return;
+	}
+	if ((*arg=='+') || (*arg=='-')) {
+		n += octave;
+	}
+	octave = (n>0) ? 1 : 0;
+	output_string_P(PSTR("\r\n-Octave:"));
+	output_number(octave);
+	output_string_P(PSTR("- "));
+}
+
+/* Tuning commands, see tuning.h */
+
+/* "trans [n|+n|-n]": transpose by n semitones, -24..24 */
+static void cmd_transpose(char* arg) {
+
+	int16_t n;
+
+	if (*arg!=0) {
+		if (!parse_number(arg, &n)) {
+			bad_arg();
+			return;
+		}
+		if ((*arg=='+') || (*arg=='-')) {
+			n += transpose;
+		}
+		if ((n<-NOTE_MAX_TRANSPOSE) || (n>NOTE_MAX_TRANSPOSE)) {
+			bad_arg();
+			return;
+		}
+		note_set_transpose(n);
+	}
+	output_string_P(PSTR("\r\n-Transpose:"));
+	if (transpose<0) {
+		output_char('-');
+	}
+	output_number((transpose<0) ? -transpose : transpose);
+	output_string_P(PSTR("- "));
+}
+
+/* "tuning [equal|just]": just intonation is on the transposed
+** key, so "trans 7" then "tuning just" plays in G
+*/
+static void cmd_tuning(char* arg) {
+
+	if (strcasecmp_P(arg, PSTR("equal"))==0) {
+		note_set_temperament(TUNING_EQUAL);
+	} else if (strcasecmp_P(arg, PSTR("just"))==0) {
+		note_set_temperament(TUNING_JUST);
+	} else if (*arg!=0) {
+		bad_arg();
+		return;
+	}
+	if (temperament==TUNING_JUST) {
+		output_string_P(PSTR("\r\n-TuningJust- "));
+	} else {
+		output_string_P(PSTR("\r\n-TuningEqual- "));
+	}
+}
+
+
+/* Envelope commands, see voice.h */
+
+static void print_env(void) {
+	output_string_P(PSTR("\r\n-Env:A"));
+	output_number(env_attack);
+	output_string_P(PSTR("ms D"));
+	output_number(env_decay);
+	output_string_P(PSTR("ms S"));
+	output_number(env_sustain);
+	output_string_P(PSTR("% R"));
+	output_number(env_release);
+	output_string_P(PSTR("ms- "));
+}
+
+/* Parse an envelope setting of 0..max. Returns 0, printing an
+** error, if there is an argument and it is not one.
+*/
+static uint8_t parse_env(char* arg, int16_t max, uint16_t* value) {
+
+	int16_t n;
+
+	if (*arg==0) {
+		return 1;
+	}
+	if (!parse_number(arg, &n) || (n<0) || (n>max)) {
+		bad_arg();
+		return 0;
+	}
+	*value = n;
+	return 1;
+}
+
+/* "attack [ms]" */
+static void cmd_attack(char* arg) {
+
+	uint16_t v = env_attack;
+
+	if (parse_env(arg, ENV_MAX_MS, &v)) {
+		voice_set_env(v, env_decay, env_sustain, env_release);
+		print_env();
+	}
+}
+
+/* "decay [ms]" */
+static void cmd_decay(char* arg) {
+
+	uint16_t v = env_decay;
+
+	if (parse_env(arg, ENV_MAX_MS, &v)) {
+		voice_set_env(env_attack, v, env_sustain, env_release);
+		print_env();
+	}
+}
+
+/* "sustain [percent]" */
+static void cmd_sustain(char* arg) {
+
+	uint16_t v = env_sustain;
+
+	if (parse_env(arg, 100, &v)) {
+		voice_set_env(env_attack, env_decay, v, env_release);
+		print_env();
+	}
+}
+
+/* "release [ms]" */
+static void cmd_release(char* arg) {
+
+	uint16_t v = env_release;
+
+	if (parse_env(arg, ENV_MAX_MS, &v)) {
+		voice_set_env(env_attack, env_decay, env_sustain, v);
+		print_env();
+	}
+}
+
+/* "env": print the envelope */
+static void cmd_env(char* arg) {
+	print_env();
+}
+
+
+/* Tune commands */
+
+/* 'D' / "demo": demo tune */
+static void cmd_demo(char* arg) {
+	if (tuneWait==255) {
+		demoTuneStart();
+		if (tuneWait!=255) {
+			output_string_P(PSTR("\r\n-DemoTune- "));
+		}
+	}
+}
+
+/* 'R' / "rec": toggle recording if available */
+static void cmd_record(char* arg) {
+	if (tuneWait==255) {
+		if (recording) {
+			record_stop();
+			output_string_P(PSTR(" -RecordingStop-"));
+		} else {
+			record_start();
+			if (recording) {
+				output_string_P(PSTR(" -RecordingStart-"));
+			} else {
+				output_string_P(PSTR(" -Saving-"));
+			}
+		}
+	}
+}
+
+/* 'P' / "play": play recording if available, or stop playing */
+static void cmd_play(char* arg) {
+	if (tuneWait!=255) {
+		playback_stop();
+		output_string_P(PSTR(" -playbackStop-"));
+	} else if ((recording==0) && (rec_length>0)) {
+		playBuffer();
+		output_string_P(PSTR(" -playbackStart-"));
+	}
+}
+
+/* "loop [on|off]": repeat the recording when played */
+static void cmd_loop(char* arg) {
+	if (strcasecmp_P(arg, PSTR("on"))==0) {
+		play_loop = 1;
+	} else if (strcasecmp_P(arg, PSTR("off"))==0) {
+		play_loop = 0;
+	} else if (*arg==0) {
+		play_loop = !play_loop;
+	} else {
+		bad_arg();
+		return;
+	}
+	output_string_P(play_loop ? PSTR("\r\n-LoopOn- ") : PSTR("\r\n-LoopOff- "));
+}
+
+/* "dub": overdub a new track on the next pass of a loop */
+static void cmd_dub(char* arg) {
+	if (overdub_start()) {
+		output_string_P(PSTR("\r\n-DubNextPass- "));
+	} else {
+		output_string_P(PSTR("\r\n-NoDub- "));
+	}
+}
+
+/* "tracks": track count and playback cycles per tick */
+static void cmd_tracks(char* arg) {
+	output_string_P(PSTR("\r\n-Tracks:"));
+	output_number(rec_tracks);
+	output_string_P(PSTR("- "));
+	bench_tracks();
+}
+
+/* "tempo [percent]": playback speed relative to the recording */
+static void cmd_tempo(char* arg) {
+
+	int16_t n;
+
+	if (*arg!=0) {
+		if (!parse_number(arg, &n) || (n<REC_TEMPO_MIN) || (n>REC_TEMPO_MAX)) {
+			bad_arg();
+			return;
+		}
+		playback_set_tempo(n);
+	}
+	output_string_P(PSTR("\r\n-Tempo:"));
+	output_number(play_tempo);
+	output_string_P(PSTR("%- "));
+}
+
+/* EEPROM slot commands, see store.h */
+
+/* Parse a slot number, printing an error if it is not one */
+static uint8_t parse_slot(char* arg, uint8_t* slot) {
+
+	int16_t n;
+
+	if (!parse_number(arg, &n) || (n<0) || (n>=STORE_SLOTS)) {
+		bad_arg();
+		return 0;
+	}
+	*slot = n;
+	return 1;
+}
+
+/* "slots": list the saved slots and their sizes in bytes */
+static void cmd_slots(char* arg) {
+
+	uint8_t i;
+
+	output_string_P(PSTR("\r\n"));
+	for (i=0; i<STORE_SLOTS; i++) {
+		output_number(i);
+		output_char(':');
+		if (store_slots[i].length) {
+			output_number(store_slots[i].length);
+		} else {
+			output_char('-');
+		}
+		output_char(' ');
+	}
+	if (store_busy) {
+		output_string_P(PSTR("-Saving- "));
+	}
+}
+
+/* "save n": save the recording to slot n */
+static void cmd_save(char* arg) {
+
+	uint8_t slot, result;
+
+	if (!parse_slot(arg, &slot) || recording) {
+		return;
+	}
+	result = store_save(slot);
+	if (result==STORE_OK) {
+		output_string_P(PSTR("\r\n-Saving- "));
+	}
+	store_print_result(result);
+}
+
+/* "load n": make slot n the recording, not while a tune plays */
+static void cmd_load(char* arg) {
+
+	uint8_t slot, result;
+
+	if (!parse_slot(arg, &slot) || recording || (tuneWait!=255)) {
+		return;
+	}
+	result = store_load(slot);
+	if (result==STORE_OK) {
+		output_string_P(PSTR("\r\n-Loaded- "));
+	}
+	store_print_result(result);
+}
+
+/* Parse a tempo such as "120", "92.5" or "140.25" into
+** hundredths of a BPM. Returns 0 if it is not one.
+*/
+static uint8_t parse_bpm(char* s, uint16_t* bpm) {
+
+	uint32_t v = 0;
+	uint8_t digits = 0, decimals = 0, point = 0;
+
+	for (; *s; s++) {
+		if ((*s=='.') && !point) {
+			point = 1;
+		} else if ((*s>='0') && (*s<='9') && (digits<5) && (decimals<2)) {
+			v = v*10 + (*s-'0');
+			digits++;
+			decimals += point;
+		} else {
+			return 0;
+		}
+	}
+	if (digits==0) {
+		return 0;
+	}
+	for (; decimals<2; decimals++) {
+		v *= 10;
+	}
+	if ((v<TEMPO_MIN) || (v>TEMPO_MAX)) {
+		return 0;
+	}
+	*bpm = v;
+	return 1;
+}
+
+/* "bpm [n]": set the beat tempo, to two decimals. The whole
+** beats are also scrolled on the display.
+*/
+static void cmd_bpm(char* arg) {
+
+	uint16_t bpm;
+	uint8_t whole;
+	char text[8] = "bpm ";
+	char* p = text+4;
+
+	if (*arg!=0) {
+		if (!parse_bpm(arg, &bpm)) {
+			bad_arg();
+			return;
+		}
+		tempo_set_bpm(bpm);
+	}
+	output_string_P(PSTR("\r\n-Bpm:"));
+	output_number(tempo_bpm/100);
+	output_char('.');
+	output_char('0' + (tempo_bpm/10)%10);
+	output_char('0' + tempo_bpm%10);
+	output_string_P(PSTR("- "));
+
+	whole = tempo_bpm/100;
+	if (whole>=100) {
+		*p++ = '0' + whole/100;
+	}
+	*p++ = '0' + (whole/10)%10;
+	*p++ = '0' + whole%10;
+	*p = 0;
+	segment_scroll(text);
+}
+
+/* "swing [percent]": delay every second sixteenth, 50 is even */
+static void cmd_swing(char* arg) {
+
+	int16_t n;
+
+	if (*arg!=0) {
+		if (!parse_number(arg, &n) || (n<TEMPO_SWING_MIN) || (n>TEMPO_SWING_MAX)) {
+			bad_arg();
+			return;
+		}
+		tempo_set_swing(n);
+	}
+	output_string_P(PSTR("\r\n-Swing:"));
+	output_number(tempo_swing);
+	output_string_P(PSTR("%- "));
+}
+
+
+/* "bright [level]": 7-segment display brightness, 0 (off) to
+** SEGMENT_LEVELS
+*/
+static void cmd_bright(char* arg) {
+
+	int16_t n;
+
+	if (*arg!=0) {
+		if (!parse_number(arg, &n) || (n<0) || (n>SEGMENT_LEVELS)) {
+			bad_arg();
+			return;
+		}
+		segment_set_brightness(n);
+	}
+	output_string_P(PSTR("\r\n-Bright:"));
+	output_number(segment_brightness);
+	output_string_P(PSTR("- "));
+}
+
+
+/* "stream [rate]": play PCM from the serial port, see stream.h */
+static void cmd_stream(char* arg) {
+
+	int16_t n = STREAM_DEFAULT_RATE;
+
+	if ((*arg!=0) && (!parse_number(arg, &n) || (n<(int16_t)STREAM_MIN_RATE))) {
+		bad_arg();
+		return;
+	}
+	if ((recording==0) && (tuneWait==255)) {
+		stream_start(n);
+	}
+}
+
+/* "midi": switch to MIDI input at 31250 baud until reset,
+** see midi.h. There is no reply.
+*/
+static void cmd_midi(char* arg) {
+	if ((recording==0) && (tuneWait==255)) {
+		midi_start();
+	}
+}
+
+/* "baud n": change the serial baud rate. There is no reply;
+** switch the terminal to the new rate.
+*/
+static void cmd_baud(char* arg) {
+
+	/* The argument overflows parse_number, so it is read here */
+	uint32_t baud = 0;
+	char* s = arg;
+
+	for (; (*s>='0') && (*s<='9') && (baud<10000000UL); s++) {
+		baud = baud*10 + (*s-'0');
+	}
+	if ((s==arg) || (*s!=0) || (baud<1200) || (baud>F_CPU/8)) {
+		bad_arg();
+		return;
+	}
+	serial_set_baud(baud);
+}
+
+
+/* Diagnostics */
+
+/* 'A': print and reset the audio FIFO statistics */
+static void cmd_audio_stats(char* arg) {
+	output_string_P(PSTR("\r\nUnderruns:"));
+	output_number(audio_underruns);
+	output_string_P(PSTR(" FifoHigh:"));
+	output_number(audio_fifo_high);
+	output_string_P(PSTR(" "));
+	audio_stats_reset();
+}
+
+/* 'X': print and clear the serial dropped byte counts */
+static void cmd_serial_stats(char* arg) {
+	output_string_P(PSTR("\r\nTxDropped:"));
+	output_number(serial_tx_dropped);
+	output_string_P(PSTR(" RxDropped:"));
+	output_number(serial_rx_dropped);
+	output_string_P(PSTR(" RxOverruns:"));
+	output_number(serial_rx_overruns);
+	output_string_P(PSTR(" "));
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		serial_tx_dropped = 0;
+		serial_rx_dropped = 0;
+		serial_rx_overruns = 0;
+	}
+}
+
+/* 'O': print and clear the task overrun counts */
+static void cmd_tasks(char* arg) {
+	sched_report();
+}
+
+/* "power": print the time asleep since the last report */
+static void cmd_power(char* arg) {
+	power_report();
+}
+
+/* 'Q': print the interrupt profiling stats */
+static void cmd_profile(char* arg) {
+	profile_dump();
+}
+
+/* 'Z': clear the interrupt profiling stats */
+static void cmd_profile_reset(char* arg) {
+	profile_reset();
+}
+
+/* 'B': benchmark the voice mixer */
+static void cmd_bench(char* arg) {
+	if ((recording==0) && (tuneWait==255)) {
+		bench_voices();
+	}
+}
+
+static void cmd_help(char* arg);
+
+
+static const cmd_t commands[] PROGMEM = {
+	/* Single keys */
+	{"T", cmd_triangle},
+	{"S", cmd_sine},
+	{"W", cmd_next_wave},
+	{"I", cmd_interp},
+	{"D", cmd_demo},
+	{"<", cmd_steps_dec},
+	{">", cmd_steps_inc},
+	{"U", cmd_octave_toggle},
+	{"R", cmd_record},
+	{"P", cmd_play},
+	{"A", cmd_audio_stats},
+	{"X", cmd_serial_stats},
+	{"O", cmd_tasks},
+	{"Q", cmd_profile},
+	{"Z", cmd_profile_reset},
+	{"B", cmd_bench},
+	/* Words */
+	{"wave", cmd_wave},
+	{"interp", cmd_interp},
+	{"steps", cmd_steps},
+	{"oct", cmd_oct},
+	{"trans", cmd_transpose},
+	{"tuning", cmd_tuning},
+	{"attack", cmd_attack},
+	{"decay", cmd_decay},
+	{"sustain", cmd_sustain},
+	{"release", cmd_release},
+	{"env", cmd_env},
+	{"bpm", cmd_bpm},
+	{"swing", cmd_swing},
+	{"bright", cmd_bright},
+	{"demo", cmd_demo},
+	{"rec", cmd_record},
+	{"play", cmd_play},
+	{"loop", cmd_loop},
+	{"tempo", cmd_tempo},
+	{"dub", cmd_dub},
+	{"tracks", cmd_tracks},
+	{"slots", cmd_slots},
+	{"save", cmd_save},
+	{"load", cmd_load},
+	{"audio", cmd_audio_stats},
+	{"serial", cmd_serial_stats},
+	{"tasks", cmd_tasks},
+	{"power", cmd_power},
+	{"prof", cmd_profile},
+	{"bench", cmd_bench},
+	{"stream", cmd_stream},
+	{"baud", cmd_baud},
+	{"midi", cmd_midi},
+	{"help", cmd_help},
+};
+
+#define NUM_COMMANDS (sizeof(commands)/sizeof(commands[0]))
+
+
+/* "help": list the commands */
+static void cmd_help(char* arg) {
+
+	uint8_t i;
+
+	output_string_P(PSTR("\r\n"));
+	for (i=0; i<NUM_COMMANDS; i++) {
+		output_string_P(commands[i].name);
+		output_string_P(PSTR(" "));
+	}
+}
+
+
+/* Run the command named by word, returning 0 if there is none */
+static uint8_t cmd_execute(char* word, char* arg) {
+
+	uint8_t i;
+
+	for (i=0; i<NUM_COMMANDS; i++) {
+		if (strcasecmp_P(word, commands[i].name)==0) {
+			((cmd_fn)pgm_read_ptr(&commands[i].fn))(arg);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/* Split the finished line into word and argument and run it */
+static void cmd_line(void) {
+
+	char* arg;
+
+	line[lineLen] = 0;
+	arg = line;
+	while ((*arg!=0) && (*arg!=' ')) {
+		arg++;
+	}
+	if (*arg==' ') {
+		*arg++ = 0;
+		while (*arg==' ') {
+			arg++;
+		}
+	}
+	if (!cmd_execute(line, arg)) {
+		output_string_P(PSTR("\r\n-Unknown- "));
+	}
+}
+
+
+/* Add a character to the line. Returns 1 if a command ran. */
+static uint8_t cmd_input(char c) {
+
+	/* A single key waits for the character after it: a space ends
+	** it like CR does, anything else makes it the start of a word
+	*/
+	if (keyPending) {
+		keyPending = 0;
+		if (c==' ') {
+			c = '\r';
+		}
+	}
+
+	if ((c=='\r') || (c=='\n')) {
+		if (lineOverflow) {
+			output_string_P(PSTR("\r\n-TooLong- "));
+		} else if (lineLen>0) {
+			cmd_line();
+		}
+		lineLen = 0;
+		lineOverflow = 0;
+		return 1;
+	}
+
+	/* Backspace/delete */
+	if ((c=='\b') || (c==0x7F)) {
+		if (lineLen>0) {
+			lineLen--;
+		}
+		return 0;
+	}
+
+	/* Spaces before the word are skipped. Anything but a lower
+	** case letter may be a single key command.
+	*/
+	if ((lineLen==0) && !lineOverflow) {
+		if (c==' ') {
+			return 0;
+		}
+		keyPending = !((c>='a') && (c<='z'));
+	}
+
+	if (lineLen < CMD_LINE_SIZE-1) {
+		line[lineLen++] = c;
+	} else {
+		lineOverflow = 1;
+	}
+	return 0;
+}
+
+
+void cmd_poll(void) {
+
+	char c;
+
+	/* Stop after one command so a burst of input can't hold
+	** off the audio rendering for long
+	*/
+	while (serial_getc(&c)) {
+		if (cmd_input(c)) {
+			break;
+		}
+	}
+}
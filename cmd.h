@@ -0,0 +1,21 @@
+/* cmd.h
+**
+** Serial command interpreter. Commands are either a single key
+** (e.g. 'W') run once a space, CR or LF follows it, or a line
+** "word [argument]"
+** ended by CR or LF (e.g. "bpm 140"); "help" lists them all.
+*/
+
+#ifndef CMD_H
+#define CMD_H
+
+/* Longest command word + 1 */
+#define CMD_NAME_SIZE 8
+
+/* Longest command line + 1 */
+#define CMD_LINE_SIZE 24
+
+/* Parse and run received commands - main loop */
+void cmd_poll(void);
+
+#endif
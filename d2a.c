@@ -9,61 +9,64 @@
 ** D2A can be used.
 ** Output can be sent to the digital to analog converter
 ** using the d2a_output() function - which accepts an 
-** unsigned 8 bit integer (i.e. in the range of 0 to 255
-** inclusive).
+** unsigned 12 bit sample (i.e. in the range of 0 to 4095
+** inclusive). It is called once per sample from the note
+** timer interrupt, which sends the whole frame itself: one
+** interrupt per sample, with a busy-wait of a byte's 16
+** cycles at clk/2.
 */
 
-#include <avr/io.h>
+#include "hal.h"
+#include "d2a.h"
+
+/* Set while a frame's sync is low. A frame is left open when
+** its low byte has been written and closed by the next one,
+** so d2a_output() only waits for the high byte.
+*/
+static uint8_t d2a_busy = 0;
 
 /* Configure the SPI device so that we can output data to
 ** the Digital-to-analog converter DA2 PMOD.
 */
 void setup_d2a(void)
 {
-	/* Make port B, bit 0 (Sync signal) be an output, along with
-	** MOSI and SCK pins (PB2 and PB1) */
-	DDRB |= 0x07;
-	/* Setup SPCR - SPI Control Register.
-	** Enable SPI peripheral, make the AVR the
-	** master and set the clock phase appropriately.
+	/* Make the sync signal, MOSI and SCK outputs, with sync
+	** high. Enable the SPI peripheral as master at double
+	** speed, with the clock phase the DA2 needs (hal.h).
 	*/
-	SPCR = (1<<SPE)|(1<<MSTR)|(1<<CPHA);
-	/* Set the double speed bit in SPSR */
-	SPSR = (1<<SPI2X);
-	/* Take the sync signal (PB0) high */
-	PORTB |= 0x01;
+	hal_spi_setup();
 }
 
-/* Output data to the Digilent DA2 PMOD - assumed to be 
-** connected to port B (bits 0 to 3), i.e. Cerebot connector
-** JD (upper row).
-** We assume that the SPI peripheral is ready to accept new
-** data.
+/* Send a 12-bit sample to the Digilent DA2 PMOD - assumed to
+** be connected to port B (bits 0 to 3), i.e. Cerebot connector
+** JD (upper row). The DAC121 frame is 0000 (normal power-down
+** mode bits) followed by the 12 data bits, most significant
+** byte first; the DAC takes the sample on its 16th clock.
+** Must be called with interrupts disabled (e.g. from an ISR).
 */
-void d2a_output(uint8_t data)
+void d2a_output(uint16_t data)
 {
+	/* Close the last frame, clocked out long ago */
+	d2a_finish();
+	
 	/* Take Sync signal low - i.e. PB0 to 0 */
-	PORTB &= 0xFE;
-	/* Output first byte (contains 0000 + high nibble of data) */
-	SPDR = data >> 4;
-	/* Wait for transfer to be complete */
-	while((SPSR & 0x80) == 0) {
-		/* Wait for SPIF flag in SPSR to be set (see pp 169 of
-		** datasheet). The final read of SPSR (when the value is
-		** 1 will cause the bit to be set back to 0).
-		*/
-		;
-	}
-	/* SPDR register should be ready to accept next data byte.
-	** Data is 4 lower bits of value and 0000 - i.e. we
-	** don't take advantage of the full 12 bits of range
-	** on the D2A.
+	hal_dac_select();
+	/* Output first byte (contains 0000 + high nibble of data)
+	** and wait the 16 cycles it takes at clk/2
 	*/
-	SPDR = (data << 4);
-	/* Wait for transfer to be complete */
-	while((SPSR & 0x80) == 0) {
-		;
+	hal_spi_write((data >> 8) & 0x0F);
+	hal_spi_wait();
+	/* Data is the 8 lower bits of the sample */
+	hal_spi_write(data & 0xFF);
+	d2a_busy = 1;
+}
+
+void d2a_finish(void)
+{
+	if (d2a_busy) {
+		/* Take the sync signal high again */
+		hal_spi_wait();
+		hal_dac_deselect();
+		d2a_busy = 0;
 	}
-	/* Take the sync signal high again */
-	PORTB |= 0x01;
 }
@@ -9,14 +9,23 @@
 ** D2A can be used.
 ** Output can be sent to the digital to analog converter
 ** using the d2a_output() function - which accepts an 
-** unsigned 8 bit integer (i.e. in the range of 0 to 255
-** inclusive).
+** unsigned 12 bit sample (i.e. in the range of 0 to 4095
+** inclusive). The frame's first byte is waited for (16 cycles)
+** and the second left to finish on its own.
 */
 
 #ifndef D2A_H
 #define D2A_H
 
+#define D2A_MAX 4095
+#define D2A_MIDSCALE 2048
+
 void setup_d2a(void);
-void d2a_output(uint8_t data);
+void d2a_output(uint16_t data);
+
+/* End the last frame (sync high), before the SPI is switched
+** off. Interrupts disabled.
+*/
+void d2a_finish(void);
 
 #endif
@@ -0,0 +1,29 @@
+/* hal.h
+**
+** Hardware abstraction layer. Modules include this instead of
+** the avr-libc headers and reach the timers, SPI, UART and
+** GPIO through the hal_ functions, so the same sources build
+** for the ATmega64 (hal_avr.h) and for a host PC
+** (host/hal_host.h, selected by defining HAL_HOST).
+**
+** Both backends also provide the avr-libc names used directly
+** by the modules: ISR(), cli(), sei(), ATOMIC_BLOCK(),
+** PROGMEM, pgm_read_byte() and pgm_read_word().
+*/
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+
+#ifndef F_CPU
+#define F_CPU 8000000UL
+#endif
+
+#ifdef HAL_HOST
+#include "hal_host.h"
+#else
+#include "hal_avr.h"
+#endif
+
+#endif
@@ -0,0 +1,253 @@
+/* hal_avr.h
+**
+** ATmega64 backend of the hardware abstraction layer (hal.h).
+** Every function is a static inline register access, so the
+** abstraction costs nothing on the target.
+**
+** Pin assignments (Cerebot II):
+**   PORTA  push buttons (connector JA)
+**   PORTB  D2A PMOD: PB0 sync, PB1 SCK, PB2 MOSI (connector JD)
+**   PORTC  7-segment PMOD (connector JB)
+**   PORTE  RS232 PMOD on PE0..1 (connector JC), LED LD0 on PE4
+*/
+
+#ifndef HAL_AVR_H
+#define HAL_AVR_H
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+/* Audio sample timer (timer 1) */
+
+/* Interrupt on compare match A every top+1 clocks, and start
+** the timer running from the system clock in CTC mode
+*/
+static inline void hal_audio_timer_setup(uint16_t top) {
+	OCR1A = top;
+	TIMSK |= (1<<OCIE1A);
+	TCCR1B = (1<<WGM12)|(1<<CS10);
+}
+
+/* Stop timer 1's clock and interrupt. The ATmega64 has no power
+** reduction register, so a stopped clock is the saving.
+*/
+static inline void hal_audio_timer_stop(void) {
+	TCCR1B = (1<<WGM12);
+	TIMSK &= ~(1<<OCIE1A);
+}
+
+/* Restart timer 1 from zero, a full period before its next
+** interrupt
+*/
+static inline void hal_audio_timer_start(void) {
+	TCNT1 = 0;
+	TIFR = (1<<OCF1A);
+	TIMSK |= (1<<OCIE1A);
+	TCCR1B = (1<<WGM12)|(1<<CS10);
+}
+
+
+/* Control tick timer (timer 2) */
+
+/* Interrupt every 1ms: clock/64, counting up to 124 in CTC
+** mode, i.e. every 64 x 125 clock cycles at 8MHz
+*/
+static inline void hal_tick_timer_setup(void) {
+	OCR2 = 124;
+	TIMSK |= (1<<OCIE2);
+	TCCR2 = (1<<WGM21)|(0<<WGM20)|(0<<CS22)|(1<<CS21)|(1<<CS20);
+}
+
+
+/* Free-running cycle counter (timer 3) */
+
+static inline void hal_cycles_setup(void) {
+	TCCR3A = 0;
+	TCCR3B = (1<<CS30);
+}
+
+/* Current cycle count (wraps every 65536 cycles) */
+static inline uint16_t hal_cycles(void) {
+	return TCNT3;
+}
+
+
+/* SPI master, feeding the D2A */
+
+/* Enable SPI at clk/2, polled (no interrupt), with sync
+** (PB0), SCK and MOSI as outputs and sync high
+*/
+static inline void hal_spi_setup(void) {
+	DDRB |= 0x07;
+	SPCR = (1<<SPE)|(1<<MSTR)|(1<<CPHA);
+	SPSR = (1<<SPI2X);
+	PORTB |= 0x01;
+}
+
+/* Switch the SPI off (the pins hold their port levels, sync
+** high) and back on
+*/
+static inline void hal_spi_disable(void) {
+	SPCR &= ~(1<<SPE);
+}
+
+/* Back on, clearing a transfer complete flag left from before
+** it was switched off (SPSR then SPDR)
+*/
+static inline void hal_spi_enable(void) {
+	SPCR |= (1<<SPE);
+	(void)SPSR;
+	(void)SPDR;
+}
+
+/* Start sending a byte. Writing SPDR also clears the transfer
+** complete flag of the last byte once hal_spi_wait has seen it.
+*/
+static inline void hal_spi_write(uint8_t data) {
+	SPDR = data;
+}
+
+/* Wait for the byte being sent to finish */
+static inline void hal_spi_wait(void) {
+	while (!(SPSR & (1<<SPIF))) {
+		;
+	}
+}
+
+/* Take the D2A sync signal low (start of frame) */
+static inline void hal_dac_select(void) {
+	PORTB &= 0xFE;
+}
+
+/* Take the D2A sync signal high (end of frame) */
+static inline void hal_dac_deselect(void) {
+	PORTB |= 0x01;
+}
+
+
+/* UART 0 */
+
+/* Set the baud rate divider and enable transmit, receive, and
+** the receive complete and data register empty interrupts.
+** UBRR0H and UBRR0L are not adjacent in I/O space so each
+** half is written separately. u2x selects double speed mode
+** (8 samples per bit instead of 16).
+*/
+static inline void hal_uart_setup(uint16_t ubrr, uint8_t u2x) {
+	UBRR0H = ubrr >> 8;
+	UBRR0L = ubrr & 0xFF;
+	UCSR0A = u2x ? (1<<U2X0) : 0;
+	UCSR0B = (1<<RXCIE0) | (1<<UDRIE0) | (1<<RXEN0) | (1<<TXEN0);
+}
+
+static inline void hal_uart_write(uint8_t c) {
+	UDR0 = c;
+}
+
+static inline uint8_t hal_uart_read(void) {
+	return UDR0;
+}
+
+/* True if a received character was lost before UDR0 was read.
+** Must be checked before hal_uart_read() clears the flag.
+*/
+static inline uint8_t hal_uart_overrun(void) {
+	return UCSR0A & (1<<DOR0);
+}
+
+static inline void hal_uart_tx_irq_enable(void) {
+	UCSR0B |= (1<<UDRIE0);
+}
+
+static inline void hal_uart_tx_irq_disable(void) {
+	UCSR0B &= ~(1<<UDRIE0);
+}
+
+
+/* EEPROM */
+
+#define HAL_EEPROM_SIZE (E2END+1)
+
+/* Read a byte, waiting for any write in progress */
+static inline uint8_t hal_eeprom_read(uint16_t addr) {
+	while (EECR & (1<<EEWE));
+	EEAR = addr;
+	EECR |= (1<<EERE);
+	return EEDR;
+}
+
+/* Start writing a byte (about 8.5ms). EEWE must be set within
+** four cycles of EEMWE, so interrupts must be disabled.
+*/
+static inline void hal_eeprom_write(uint16_t addr, uint8_t data) {
+	while (EECR & (1<<EEWE));
+	EEAR = addr;
+	EEDR = data;
+	EECR |= (1<<EEMWE);
+	EECR |= (1<<EEWE);
+}
+
+/* The ready interrupt fires whenever no write is in progress */
+static inline void hal_eeprom_irq_enable(void) {
+	EECR |= (1<<EERIE);
+}
+
+static inline void hal_eeprom_irq_disable(void) {
+	EECR &= ~(1<<EERIE);
+}
+
+
+/* Power */
+
+/* Switch off the analog comparator, which is never used (the
+** ADC is off from reset)
+*/
+static inline void hal_power_setup(void) {
+	ACSR = (1<<ACD);
+	set_sleep_mode(SLEEP_MODE_IDLE);
+}
+
+/* Sleep until an interrupt. Called with interrupts disabled:
+** the instruction after sei always runs, so an interrupt that
+** became pending before the sleep wakes it at once. Returns
+** with interrupts enabled.
+*/
+static inline void hal_sleep(void) {
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+}
+
+
+/* GPIO */
+
+static inline uint8_t hal_buttons_read(void) {
+	return PINA;
+}
+
+static inline void hal_segment_setup(void) {
+	DDRC = 0xFF;
+}
+
+static inline void hal_segment_write(uint8_t segments) {
+	PORTC = segments;
+}
+
+static inline void hal_led_setup(void) {
+	DDRE = 0xFF;
+}
+
+/* Set LD0 (PORTE bit 4) without changing other bits */
+static inline void hal_led_write(uint8_t on) {
+	if (on) {
+		PORTE |= (1<<4);
+	} else {
+		PORTE &= 0xEF;
+	}
+}
+
+#endif
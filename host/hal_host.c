@@ -0,0 +1,384 @@
+/* hal_host.c
+**
+** Host backend of the hardware abstraction layer: a virtual
+** ATmega64 running the firmware's interrupt handlers against
+** a cycle-counted clock. Only the behaviour the firmware relies
+** on is modelled:
+**   timer 1   compare interrupt every top+1 cycles once set up,
+**             until stopped
+**   timer 2   compare interrupt every 8000 cycles (1ms)
+**   timer 3   the virtual cycle count
+**   SPI       polled; a byte is sent at once (the 16 cycles of
+**             a transfer aren't modelled), and writes are
+**             ignored while it is disabled. The DAC takes a
+**             frame on its 16th bit.
+**   UART 0    10-bit frames at the UBRR baud rate, RX and UDRE
+**             irqs, with the transmitter treated as unbuffered
+**   EEPROM    2KB, 8.5ms per byte written, ready irq
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hal.h"
+
+/* Handlers the firmware doesn't define are skipped */
+#pragma weak TIMER1_COMPA_vect
+#pragma weak TIMER2_COMP_vect
+#pragma weak USART0_RX_vect
+#pragma weak USART0_UDRE_vect
+#pragma weak EE_READY_vect
+
+#define NEVER UINT64_MAX
+#define TICK_CYCLES (F_CPU/1000)
+#define EEPROM_WRITE_CYCLES (F_CPU/1000*17/2)
+
+volatile uint8_t hal_host_irq_enabled = 0;
+hal_host_isr_stat_t hal_host_isr_stats[HAL_VECT_COUNT];
+uint8_t hal_host_profile = 0;
+
+static struct {
+	uint64_t now;
+	
+	uint64_t audio_next;
+	uint32_t audio_period;
+	uint64_t tick_next;
+	
+	uint8_t spi_on;
+	uint8_t dac_selected;
+	uint8_t dac_bytes;
+	uint16_t dac_frame;
+	uint64_t dac_frames;
+	hal_host_dac_fn dac_fn;
+	void* dac_ctx;
+	
+	uint32_t uart_byte_cycles;
+	uint8_t uart_tx_irq;
+	uint64_t uart_tx_free;
+	hal_host_uart_fn uart_fn;
+	void* uart_ctx;
+	uint8_t* rx_data;
+	size_t rx_len, rx_pos, rx_cap;
+	uint64_t rx_next;
+	uint8_t udr_rx;
+	
+	uint64_t ee_done;
+	uint8_t ee_irq;
+	
+	uint8_t buttons;
+	uint8_t segment;
+	uint8_t led;
+} hw;
+
+/* Kept across resets */
+static uint8_t eeprom[HAL_EEPROM_SIZE];
+static uint8_t eeprom_init = 0;
+static uint64_t eeprom_writes = 0;
+
+
+void hal_host_reset(void) {
+	
+	free(hw.rx_data);
+	memset(&hw, 0, sizeof(hw));
+	hw.audio_next = NEVER;
+	hw.tick_next = NEVER;
+	hw.rx_next = NEVER;
+	hw.uart_byte_cycles = 10*16*52;		//9600 baud until set up
+	hal_host_irq_enabled = 0;
+	memset(hal_host_isr_stats, 0, sizeof(hal_host_isr_stats));
+}
+
+uint64_t hal_host_now(void) {
+	return hw.now;
+}
+
+
+/* HAL functions */
+
+void hal_audio_timer_setup(uint16_t top) {
+	hw.audio_period = (uint32_t)top + 1;
+	hw.audio_next = hw.now + hw.audio_period;
+}
+
+void hal_audio_timer_stop(void) {
+	hw.audio_next = NEVER;
+}
+
+void hal_audio_timer_start(void) {
+	hw.audio_next = hw.now + hw.audio_period;
+}
+
+void hal_tick_timer_setup(void) {
+	hw.tick_next = hw.now + TICK_CYCLES;
+}
+
+void hal_cycles_setup(void) {
+}
+
+uint16_t hal_cycles(void) {
+	return (uint16_t)hw.now;
+}
+
+void hal_spi_setup(void) {
+	hw.spi_on = 1;
+}
+
+void hal_spi_disable(void) {
+	hw.spi_on = 0;
+}
+
+void hal_spi_enable(void) {
+	hw.spi_on = 1;
+}
+
+void hal_spi_write(uint8_t data) {
+	
+	if (!hw.spi_on) {
+		return;
+	}
+	if (hw.dac_selected && (hw.dac_bytes < 2)) {
+		hw.dac_frame = (hw.dac_frame << 8) | data;
+		/* The DAC updates on the 16th clock of a frame */
+		if (++hw.dac_bytes == 2) {
+			hw.dac_frames++;
+			if (hw.dac_fn) {
+				hw.dac_fn(hw.dac_frame & 0x0FFF, hw.dac_ctx);
+			}
+		}
+	}
+}
+
+void hal_spi_wait(void) {
+}
+
+void hal_dac_select(void) {
+	hw.dac_selected = 1;
+	hw.dac_bytes = 0;
+	hw.dac_frame = 0;
+}
+
+void hal_dac_deselect(void) {
+	hw.dac_selected = 0;
+}
+
+void hal_uart_setup(uint16_t ubrr, uint8_t u2x) {
+	hw.uart_byte_cycles = 10*(u2x ? 8 : 16)*((uint32_t)ubrr + 1);
+	hw.uart_tx_irq = 1;
+}
+
+void hal_uart_write(uint8_t c) {
+	
+	if (hw.uart_fn) {
+		hw.uart_fn(c, hw.uart_ctx);
+	}
+	hw.uart_tx_free = hw.now + hw.uart_byte_cycles;
+}
+
+uint8_t hal_uart_read(void) {
+	return hw.udr_rx;
+}
+
+/* Receive handlers are always dispatched before the next byte
+** arrives, so the virtual UART never overruns.
+*/
+uint8_t hal_uart_overrun(void) {
+	return 0;
+}
+
+void hal_uart_tx_irq_enable(void) {
+	hw.uart_tx_irq = 1;
+}
+
+void hal_uart_tx_irq_disable(void) {
+	hw.uart_tx_irq = 0;
+}
+
+uint8_t hal_eeprom_read(uint16_t addr) {
+	return hal_host_eeprom()[addr % HAL_EEPROM_SIZE];
+}
+
+void hal_eeprom_write(uint16_t addr, uint8_t data) {
+	hal_host_eeprom()[addr % HAL_EEPROM_SIZE] = data;
+	eeprom_writes++;
+	hw.ee_done = hw.now + EEPROM_WRITE_CYCLES;
+}
+
+void hal_eeprom_irq_enable(void) {
+	hw.ee_irq = 1;
+}
+
+void hal_eeprom_irq_disable(void) {
+	hw.ee_irq = 0;
+}
+
+void hal_power_setup(void) {
+}
+
+/* The main loop only runs after an interrupt on the host, so a
+** sleep returns at once
+*/
+void hal_sleep(void) {
+	sei();
+}
+
+uint8_t hal_buttons_read(void) {
+	return hw.buttons;
+}
+
+void hal_segment_setup(void) {
+}
+
+void hal_segment_write(uint8_t segments) {
+	hw.segment = segments;
+}
+
+void hal_led_setup(void) {
+}
+
+void hal_led_write(uint8_t on) {
+	hw.led = on;
+}
+
+
+/* Host control */
+
+void hal_host_set_buttons(uint8_t pins) {
+	hw.buttons = pins;
+}
+
+void hal_host_on_dac(hal_host_dac_fn fn, void* ctx) {
+	hw.dac_fn = fn;
+	hw.dac_ctx = ctx;
+}
+
+void hal_host_on_uart_tx(hal_host_uart_fn fn, void* ctx) {
+	hw.uart_fn = fn;
+	hw.uart_ctx = ctx;
+}
+
+void hal_host_uart_send(const uint8_t* data, size_t len) {
+	
+	if (hw.rx_len + len > hw.rx_cap) {
+		hw.rx_cap = (hw.rx_len + len) * 2;
+		hw.rx_data = realloc(hw.rx_data, hw.rx_cap);
+	}
+	memcpy(hw.rx_data + hw.rx_len, data, len);
+	hw.rx_len += len;
+	if (hw.rx_next == NEVER) {
+		hw.rx_next = hw.now + hw.uart_byte_cycles;
+	}
+}
+
+size_t hal_host_uart_pending(void) {
+	return hw.rx_len - hw.rx_pos;
+}
+
+uint8_t hal_host_segment(void) {
+	return hw.segment;
+}
+
+uint8_t hal_host_led(void) {
+	return hw.led;
+}
+
+uint64_t hal_host_dac_frames(void) {
+	return hw.dac_frames;
+}
+
+uint8_t* hal_host_eeprom(void) {
+	if (!eeprom_init) {
+		memset(eeprom, 0xFF, sizeof(eeprom));
+		eeprom_init = 1;
+	}
+	return eeprom;
+}
+
+uint64_t hal_host_eeprom_writes(void) {
+	return eeprom_writes;
+}
+
+
+/* Call one interrupt handler, timing it if profiling */
+static void dispatch(uint8_t vect, void (*handler)(void)) {
+	
+	struct timespec t0, t1;
+	
+	if (!handler) {
+		return;
+	}
+	if (!hal_host_profile) {
+		handler();
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	handler();
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	hal_host_isr_stats[vect].calls++;
+	hal_host_isr_stats[vect].ns += (uint64_t)(t1.tv_sec - t0.tv_sec)*1000000000u
+		+ (uint64_t)t1.tv_nsec - (uint64_t)t0.tv_nsec;
+}
+
+
+void hal_host_run(uint64_t cycles, void (*idle)(void)) {
+	
+	uint64_t end = hw.now + cycles;
+	uint64_t next, udre, ee;
+	uint8_t vect;
+	
+	for (;;) {
+		
+		/* Find the earliest due event; on a tie the lower
+		** vector number wins, as on the AVR
+		*/
+		udre = hw.uart_tx_irq ? (hw.uart_tx_free > hw.now ? hw.uart_tx_free : hw.now) : NEVER;
+		next = hw.tick_next; vect = HAL_VECT_TIMER2_COMP;
+		if (hw.audio_next < next) { next = hw.audio_next; vect = HAL_VECT_TIMER1_COMPA; }
+		if (hw.rx_next < next) { next = hw.rx_next; vect = HAL_VECT_USART0_RX; }
+		if (udre < next) { next = udre; vect = HAL_VECT_USART0_UDRE; }
+		ee = hw.ee_irq ? (hw.ee_done > hw.now ? hw.ee_done : hw.now) : NEVER;
+		if (ee < next) { next = ee; vect = HAL_VECT_EE_READY; }
+		
+		if ((next > end) || !hal_host_irq_enabled) {
+			hw.now = end;
+			break;
+		}
+		hw.now = next;
+		
+		switch (vect) {
+		case HAL_VECT_TIMER2_COMP:
+			hw.tick_next += TICK_CYCLES;
+			dispatch(vect, TIMER2_COMP_vect);
+			break;
+		case HAL_VECT_TIMER1_COMPA:
+			hw.audio_next += hw.audio_period;
+			dispatch(vect, TIMER1_COMPA_vect);
+			break;
+		case HAL_VECT_USART0_RX:
+			hw.udr_rx = hw.rx_data[hw.rx_pos++];
+			if (hw.rx_pos < hw.rx_len) {
+				hw.rx_next += hw.uart_byte_cycles;
+			} else {
+				hw.rx_next = NEVER;
+				hw.rx_pos = hw.rx_len = 0;
+			}
+			dispatch(vect, USART0_RX_vect);
+			break;
+		case HAL_VECT_USART0_UDRE:
+			dispatch(vect, USART0_UDRE_vect);
+			/* A handler that neither writes nor disables the
+			** interrupt would spin; treat it as disabled
+			*/
+			if (hw.uart_tx_free <= hw.now) {
+				hw.uart_tx_irq = 0;
+			}
+			break;
+		case HAL_VECT_EE_READY:
+			dispatch(vect, EE_READY_vect);
+			break;
+		}
+		
+		if (idle) {
+			idle();
+		}
+	}
+}
@@ -0,0 +1,153 @@
+/* hal_host.h
+**
+** Host (PC) backend of the hardware abstraction layer. The
+** firmware modules run unchanged on a virtual ATmega64: time is
+** counted in virtual CPU cycles and interrupt handlers are
+** called by hal_host_run() when their timer, UART or EEPROM event
+** falls due. Between interrupts the caller's idle function
+** (the main loop body) is run.
+**
+** The hal_host_ functions let host programs drive the inputs
+** (buttons, serial RX) and capture the outputs (D2A samples,
+** serial TX, 7-segment and LED).
+*/
+
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+/* avr-libc equivalents */
+
+#define ISR(vector) void vector(void)
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_ptr(addr) (*(const void* const*)(addr))
+#define PSTR(s) (s)
+#define PGM_P const char*
+#define strcmp_P(s1, s2) strcmp((s1), (s2))
+#define strcasecmp_P(s1, s2) strcasecmp((s1), (s2))
+
+/* The virtual CPU runs one interrupt handler or main loop
+** iteration at a time, so atomic blocks need no locking. The
+** flag still gates hal_host_run() dispatching interrupts.
+*/
+extern volatile uint8_t hal_host_irq_enabled;
+#define sei() (hal_host_irq_enabled = 1)
+#define cli() (hal_host_irq_enabled = 0)
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_BLOCK(type) for (uint8_t hal_atomic_once = 1; hal_atomic_once; hal_atomic_once = 0)
+
+/* Interrupt handlers the firmware may define */
+void TIMER1_COMPA_vect(void);
+void TIMER2_COMP_vect(void);
+void USART0_RX_vect(void);
+void USART0_UDRE_vect(void);
+void EE_READY_vect(void);
+
+/* HAL functions, as in hal_avr.h */
+void hal_audio_timer_setup(uint16_t top);
+void hal_audio_timer_stop(void);
+void hal_audio_timer_start(void);
+void hal_tick_timer_setup(void);
+void hal_cycles_setup(void);
+uint16_t hal_cycles(void);
+void hal_spi_setup(void);
+void hal_spi_disable(void);
+void hal_spi_enable(void);
+void hal_spi_write(uint8_t data);
+void hal_spi_wait(void);
+void hal_dac_select(void);
+void hal_dac_deselect(void);
+void hal_uart_setup(uint16_t ubrr, uint8_t u2x);
+void hal_uart_write(uint8_t c);
+uint8_t hal_uart_read(void);
+uint8_t hal_uart_overrun(void);
+void hal_uart_tx_irq_enable(void);
+void hal_uart_tx_irq_disable(void);
+#define HAL_EEPROM_SIZE 2048
+uint8_t hal_eeprom_read(uint16_t addr);
+void hal_eeprom_write(uint16_t addr, uint8_t data);
+void hal_eeprom_irq_enable(void);
+void hal_eeprom_irq_disable(void);
+void hal_power_setup(void);
+void hal_sleep(void);
+uint8_t hal_buttons_read(void);
+void hal_segment_setup(void);
+void hal_segment_write(uint8_t segments);
+void hal_led_setup(void);
+void hal_led_write(uint8_t on);
+
+
+/* Host control */
+
+/* Interrupt vectors, numbered as on the ATmega64. When several
+** events fall due together the lowest vector runs first.
+*/
+enum {
+	HAL_VECT_TIMER2_COMP = 9,
+	HAL_VECT_TIMER1_COMPA = 12,
+	HAL_VECT_USART0_RX = 18,
+	HAL_VECT_USART0_UDRE = 19,
+	HAL_VECT_EE_READY = 22,
+	HAL_VECT_COUNT = 35
+};
+
+/* Per-vector wall-clock cost of the handlers, collected when
+** hal_host_profile is set
+*/
+typedef struct {
+	uint64_t calls;
+	uint64_t ns;
+} hal_host_isr_stat_t;
+
+extern hal_host_isr_stat_t hal_host_isr_stats[HAL_VECT_COUNT];
+extern uint8_t hal_host_profile;
+
+/* Called for every complete D2A frame, with the 12-bit sample */
+typedef void (*hal_host_dac_fn)(uint16_t sample, void* ctx);
+
+/* Called for every byte the UART transmits */
+typedef void (*hal_host_uart_fn)(uint8_t c, void* ctx);
+
+/* Return all devices to their reset state and time to zero */
+void hal_host_reset(void);
+
+/* Virtual CPU cycles since reset */
+uint64_t hal_host_now(void);
+
+/* Run for the given number of virtual cycles, dispatching due
+** interrupts and calling idle() (if not null) after each one
+*/
+void hal_host_run(uint64_t cycles, void (*idle)(void));
+
+void hal_host_set_buttons(uint8_t pins);
+void hal_host_on_dac(hal_host_dac_fn fn, void* ctx);
+void hal_host_on_uart_tx(hal_host_uart_fn fn, void* ctx);
+
+/* Queue bytes to arrive on the UART, back to back at the
+** configured baud rate after any already queued
+*/
+void hal_host_uart_send(const uint8_t* data, size_t len);
+size_t hal_host_uart_pending(void);
+
+/* Last values written to the display and LED */
+uint8_t hal_host_segment(void);
+uint8_t hal_host_led(void);
+
+/* Total D2A frames output since reset */
+uint64_t hal_host_dac_frames(void);
+
+/* The EEPROM contents, which survive hal_host_reset() as on
+** the real part; erased (0xFF) at start
+*/
+uint8_t* hal_host_eeprom(void);
+
+/* EEPROM bytes written since start */
+uint64_t hal_host_eeprom_writes(void);
+
+#endif
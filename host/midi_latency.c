@@ -0,0 +1,390 @@
+/* midi_latency.c
+**
+** Host MIDI latency harness. Runs the firmware on the virtual
+** MCU, switches it to MIDI mode through the serial "midi"
+** command, and plays a Standard MIDI File (format 0 or 1) into
+** the UART at 31250 baud, in real time and using running status
+** where the file allows. Without a file a dense synthetic stream
+** is generated: a new note every 2ms over four voices with
+** random velocities and pitch bends.
+**
+** For every Note On/Off, pitch bend and All Notes/Sound Off the
+** latency is measured from the arrival of the message's last
+** byte to the first D2A frame rendered after the firmware
+** applied it (to within one sample). The distribution is
+** printed at the end.
+**
+** Usage: midi_latency [-t max-seconds] [file.mid]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hal.h"
+#include "app.h"
+#include "audio.h"
+#include "midi.h"
+
+#define MS (F_CPU/1000)
+#define BYTE_CYCLES (F_CPU*10/MIDI_BAUD)
+
+typedef struct {
+	uint64_t tick;		//file ticks, then virtual cycles
+	uint32_t order;		//file order, for a stable sort
+	uint32_t tempo;		//microseconds per quarter note, 0 if a message
+	uint8_t len;
+	uint8_t data[3];
+} event_t;
+
+static event_t* events;
+static size_t numEvents, capEvents;
+
+/* Messages the firmware has not applied yet (arrival cycles),
+** then frames awaited for the latency (target frame, arrival)
+*/
+#define MAX_PENDING 4096
+static uint64_t pendArrival[MAX_PENDING];
+static size_t pendHead, pendTail;
+static uint64_t waitFrame[MAX_PENDING], waitArrival[MAX_PENDING];
+static size_t waitHead, waitTail;
+static uint16_t applied;
+
+static double* latency;
+static size_t numLatency, capLatency;
+
+
+static event_t* add_event(void) {
+
+	if (numEvents == capEvents) {
+		capEvents = capEvents ? capEvents*2 : 1024;
+		events = realloc(events, capEvents * sizeof(event_t));
+	}
+	memset(&events[numEvents], 0, sizeof(event_t));
+	events[numEvents].order = numEvents;
+	return &events[numEvents++];
+}
+
+static void add_latency(double ms) {
+
+	if (numLatency == capLatency) {
+		capLatency = capLatency ? capLatency*2 : 1024;
+		latency = realloc(latency, capLatency * sizeof(double));
+	}
+	latency[numLatency++] = ms;
+}
+
+
+/* Standard MIDI File reader */
+
+static uint32_t be(const uint8_t* p, int n) {
+
+	uint32_t v = 0;
+
+	while (n--) {
+		v = (v << 8) | *p++;
+	}
+	return v;
+}
+
+static uint32_t vlq(const uint8_t** p, const uint8_t* end) {
+
+	uint32_t v = 0;
+
+	while (*p < end) {
+		uint8_t c = *(*p)++;
+		v = (v << 7) | (c & 0x7F);
+		if (!(c & 0x80)) {
+			break;
+		}
+	}
+	return v;
+}
+
+static void read_track(const uint8_t* p, const uint8_t* end) {
+
+	uint64_t tick = 0;
+	uint8_t status = 0;
+	event_t* ev;
+
+	while (p < end) {
+		tick += vlq(&p, end);
+		if (p >= end) {
+			break;
+		}
+		if (*p & 0x80) {
+			status = *p++;
+		}
+		if (status == 0xFF) {
+			/* Meta event; only tempo matters */
+			uint8_t type = *p++;
+			uint32_t len = vlq(&p, end);
+			if ((type == 0x51) && (len == 3)) {
+				ev = add_event();
+				ev->tick = tick;
+				ev->tempo = be(p, 3);
+			}
+			p += len;
+			status = 0;
+		} else if ((status == 0xF0) || (status == 0xF7)) {
+			/* System exclusive, not sent */
+			p += vlq(&p, end);
+			status = 0;
+		} else if (status & 0x80) {
+			ev = add_event();
+			ev->tick = tick;
+			ev->data[0] = status;
+			ev->data[1] = *p++;
+			ev->len = 2;
+			if ((status & 0xE0) != 0xC0) {
+				ev->data[2] = *p++;
+				ev->len = 3;
+			}
+		} else {
+			/* Data without a status */
+			p++;
+		}
+	}
+}
+
+static int read_smf(const char* path) {
+
+	FILE* f = fopen(path, "rb");
+	uint8_t* data;
+	const uint8_t *p, *end;
+	long n;
+	uint32_t division, tempo = 500000, len;
+	uint64_t lastTick = 0, cycles = 0;
+	size_t i;
+
+	if (!f) {
+		perror(path);
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	n = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	data = malloc(n);
+	if (fread(data, 1, n, f) != (size_t)n) {
+		n = 0;
+	}
+	fclose(f);
+
+	if ((n < 14) || memcmp(data, "MThd", 4)) {
+		fprintf(stderr, "%s: not a MIDI file\n", path);
+		return 0;
+	}
+	division = be(data + 12, 2);
+	if (division & 0x8000) {
+		fprintf(stderr, "%s: SMPTE time division not supported\n", path);
+		return 0;
+	}
+	p = data + 8 + be(data + 4, 4);
+	end = data + n;
+	while (p + 8 <= end) {
+		len = be(p + 4, 4);
+		if ((memcmp(p, "MTrk", 4) == 0) && (p + 8 + len <= end)) {
+			read_track(p + 8, p + 8 + len);
+		}
+		p += 8 + len;
+	}
+	free(data);
+
+	/* Merge the tracks and convert ticks to cycles through the
+	** tempo map
+	*/
+	for (i = 1; i < numEvents; i++) {
+		event_t e = events[i];
+		size_t j = i;
+		while ((j > 0) && ((events[j-1].tick > e.tick) ||
+				((events[j-1].tick == e.tick) && (events[j-1].order > e.order)))) {
+			events[j] = events[j-1];
+			j--;
+		}
+		events[j] = e;
+	}
+	for (i = 0; i < numEvents; i++) {
+		uint64_t t = events[i].tick;
+		cycles += (t - lastTick) * tempo / division * (F_CPU / 1000000);
+		lastTick = t;
+		events[i].tick = cycles;
+		if (events[i].tempo) {
+			tempo = events[i].tempo;
+		}
+	}
+	return 1;
+}
+
+
+/* Dense synthetic stream */
+static void synthesise(double seconds) {
+
+	uint8_t keys[4] = {0, 0, 0, 0};
+	uint64_t t;
+	event_t* ev;
+	int v = 0;
+
+	srand(1);
+	for (t = 0; t < (uint64_t)(seconds * F_CPU); t += 2*MS) {
+		if (keys[v]) {
+			ev = add_event();
+			ev->tick = t;
+			ev->data[0] = MIDI_NOTE_ON;
+			ev->data[1] = keys[v];
+			ev->data[2] = 0;
+			ev->len = 3;
+		}
+		keys[v] = 36 + rand() % 60;
+		ev = add_event();
+		ev->tick = t;
+		ev->data[0] = MIDI_NOTE_ON;
+		ev->data[1] = keys[v];
+		ev->data[2] = 1 + rand() % 127;
+		ev->len = 3;
+		if ((rand() & 7) == 0) {
+			ev = add_event();
+			ev->tick = t;
+			ev->data[0] = MIDI_PITCH_BEND;
+			ev->data[1] = rand() & 0x7F;
+			ev->data[2] = rand() & 0x7F;
+			ev->len = 3;
+		}
+		v = (v + 1) & 3;
+	}
+}
+
+
+/* Messages the firmware queues for midi_poll */
+static int counted(const event_t* ev) {
+
+	uint8_t s = ev->data[0] & 0xF0;
+
+	return (s == MIDI_NOTE_ON) || (s == MIDI_NOTE_OFF) || (s == MIDI_PITCH_BEND) ||
+		((s == MIDI_CONTROL) && (ev->data[1] >= MIDI_CC_MODE));
+}
+
+/* The main loop. Events applied now are in the first
+** sample rendered after the ones already queued.
+*/
+static void idle(void) {
+
+	app_drain();
+	while ((applied != midi_events) && (pendTail != pendHead)) {
+		waitFrame[waitHead % MAX_PENDING] = hal_host_dac_frames() + audio_level() + 1;
+		waitArrival[waitHead % MAX_PENDING] = pendArrival[pendTail++ % MAX_PENDING];
+		waitHead++;
+		applied++;
+	}
+}
+
+static void dac(uint16_t sample, void* ctx) {
+
+	uint64_t frames = hal_host_dac_frames();
+
+	while ((waitTail != waitHead) && (waitFrame[waitTail % MAX_PENDING] <= frames)) {
+		add_latency((double)(hal_host_now() - waitArrival[waitTail % MAX_PENDING]) * 1000 / F_CPU);
+		waitTail++;
+	}
+}
+
+static int cmp(const void* a, const void* b) {
+
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv) {
+
+	double seconds = 0;
+	uint64_t start, uartFree = 0;
+	uint8_t running = 0;
+	size_t i, bytes = 0;
+	double sum = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		if (opt == 't') {
+			seconds = atof(optarg);
+		} else {
+			optind = argc + 1;
+		}
+	}
+	if (optind > argc) {
+		fprintf(stderr, "usage: %s [-t max-seconds] [file.mid]\n", argv[0]);
+		return 1;
+	}
+	if (optind < argc) {
+		if (!read_smf(argv[optind])) {
+			return 1;
+		}
+	} else {
+		synthesise(seconds > 0 ? seconds : 5);
+	}
+
+	hal_host_reset();
+	hal_host_on_dac(dac, NULL);
+	app_setup();
+	sei();
+	hal_host_run(10*MS, idle);
+	hal_host_uart_send((const uint8_t*)"midi\r", 5);
+	while (hal_host_uart_pending()) {
+		hal_host_run(MS, idle);
+	}
+	hal_host_run(MS, idle);
+	applied = midi_events;
+
+	/* Send each message when due, as a keyboard would */
+	start = hal_host_now();
+	for (i = 0; i < numEvents; i++) {
+		event_t* ev = &events[i];
+		uint64_t due = start + ev->tick;
+		uint8_t skip;
+
+		if (ev->len == 0) {
+			continue;
+		}
+		if ((seconds > 0) && (ev->tick > seconds * F_CPU)) {
+			break;
+		}
+		if (hal_host_now() < due) {
+			hal_host_run(due - hal_host_now(), idle);
+		}
+
+		/* Running status: drop a repeated status byte */
+		skip = (ev->data[0] == running);
+		running = ev->data[0];
+		hal_host_uart_send(ev->data + skip, ev->len - skip);
+		bytes += ev->len - skip;
+
+		/* Arrival of the last byte, after any still queued */
+		if (uartFree < hal_host_now()) {
+			uartFree = hal_host_now();
+		}
+		uartFree += (ev->len - skip) * BYTE_CYCLES;
+		if (counted(ev)) {
+			if (pendHead - pendTail >= MAX_PENDING) {
+				fprintf(stderr, "too many messages in flight\n");
+				return 1;
+			}
+			pendArrival[pendHead++ % MAX_PENDING] = uartFree;
+		}
+	}
+	hal_host_run(100*MS, idle);
+
+	printf("messages %zu, %zu bytes in %.2fs, dropped %u\n",
+		pendHead, bytes, (double)(hal_host_now() - start) / F_CPU, midi_dropped);
+	if (numLatency == 0) {
+		return 1;
+	}
+	qsort(latency, numLatency, sizeof(double), cmp);
+	for (i = 0; i < numLatency; i++) {
+		sum += latency[i];
+	}
+	printf("event-to-sample latency (ms): min %.3f mean %.3f p50 %.3f "
+		"p95 %.3f p99 %.3f max %.3f\n",
+		latency[0], sum / numLatency, latency[numLatency / 2],
+		latency[numLatency * 95 / 100], latency[numLatency * 99 / 100],
+		latency[numLatency - 1]);
+	return (midi_dropped != 0);
+}
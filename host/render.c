@@ -0,0 +1,335 @@
+/* render.c
+**
+** Offline renderer. Runs the firmware on the virtual MCU from
+** reset, plays a script of button and serial input into it and
+** writes the D2A output to a 16-bit mono WAV file at
+** AUDIO_SAMPLE_RATE, as fast as the host allows. While the
+** audio path is off for silence (audio.h) the D2A holds its
+** last sample, which fills the gap in the file. The render
+** throughput is reported in samples per second of wall-clock
+** time.
+**
+** With -g the output is compared with a golden WAV file (one
+** written by an earlier render) and the run fails if the lengths
+** differ or any sample is further from it than the tolerance,
+** in D2A steps (default 0, bit exact). The number of differing
+** samples, the first of them and the max/RMS error are printed.
+**
+** A script has one event per line, at a time in ms from reset:
+**
+**   # comment
+**   100 keys 0x05        set the buttons (PINA)
+**   500 send wave sine   type a line, CR added
+**   2000 end             stop rendering
+**
+** Events must be in time order. Lines typed at 9600 baud take
+** about 1ms per character to arrive.
+**
+** Usage: render [-o out.wav] [-g golden.wav] [-e tolerance] script
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "hal.h"
+#include "app.h"
+#include "notes.h"
+
+#define MS (F_CPU/1000)
+#define SAMPLE_CYCLES (F_CPU/AUDIO_SAMPLE_RATE)
+#define LINE_SIZE 128
+
+/* D2A samples rendered */
+static uint16_t* samples;
+static size_t numSamples, capSamples;
+
+
+static double now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+static void add_sample(uint16_t sample) {
+
+	if (numSamples == capSamples) {
+		capSamples = capSamples ? capSamples*2 : 65536;
+		samples = realloc(samples, capSamples * sizeof(uint16_t));
+	}
+	samples[numSamples++] = sample;
+}
+
+/* Repeat the held sample up to sample n */
+static void hold_to(uint64_t n) {
+
+	uint16_t held = numSamples ? samples[numSamples-1] : 2048;
+
+	while (numSamples < n) {
+		add_sample(held);
+	}
+}
+
+/* Samples due by now. Frame k is sent during sample period
+** k+1, so none are before the first period ends.
+*/
+static uint64_t samples_due(void) {
+
+	uint64_t period = hal_host_now() / SAMPLE_CYCLES;
+
+	return period ? period - 1 : 0;
+}
+
+static void dac(uint16_t sample, void* ctx) {
+	hold_to(samples_due());
+	add_sample(sample);
+}
+
+
+/* Little endian fields of a WAV header */
+static void put16(FILE* f, uint16_t v) {
+	fputc(v & 0xFF, f);
+	fputc(v >> 8, f);
+}
+
+static void put32(FILE* f, uint32_t v) {
+	put16(f, v & 0xFFFF);
+	put16(f, v >> 16);
+}
+
+static uint32_t get32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* 12-bit D2A samples are centred and scaled to 16 bits */
+static int write_wav(const char* path) {
+
+	FILE* f = fopen(path, "wb");
+	size_t i;
+
+	if (!f) {
+		perror(path);
+		return 0;
+	}
+	fwrite("RIFF", 1, 4, f);
+	put32(f, 36 + numSamples*2);
+	fwrite("WAVEfmt ", 1, 8, f);
+	put32(f, 16);
+	put16(f, 1);			//PCM
+	put16(f, 1);			//mono
+	put32(f, AUDIO_SAMPLE_RATE);
+	put32(f, AUDIO_SAMPLE_RATE*2);
+	put16(f, 2);
+	put16(f, 16);
+	fwrite("data", 1, 4, f);
+	put32(f, numSamples*2);
+	for (i=0; i<numSamples; i++) {
+		put16(f, (uint16_t)(((int16_t)samples[i] - 2048) * 16));
+	}
+	fclose(f);
+	return 1;
+}
+
+/* Read a WAV file written by write_wav back to D2A samples */
+static uint16_t* read_wav(const char* path, size_t* len) {
+
+	FILE* f = fopen(path, "rb");
+	uint8_t* data;
+	uint16_t* out = NULL;
+	uint32_t size, pos = 12;
+	long n;
+	size_t i;
+
+	if (!f) {
+		perror(path);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	n = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	data = malloc(n > 0 ? n : 1);
+	if ((fread(data, 1, n, f) != (size_t)n) || (n < 12) ||
+			(memcmp(data, "RIFF", 4) != 0) || (memcmp(data + 8, "WAVE", 4) != 0)) {
+		fprintf(stderr, "%s: not a WAV file\n", path);
+		goto done;
+	}
+	while (pos + 8 <= (uint32_t)n) {
+		size = get32(data + pos + 4);
+		if ((memcmp(data + pos, "fmt ", 4) == 0) && (size >= 16) &&
+				((data[pos+8] != 1) || (data[pos+10] != 1) ||
+				(get32(data + pos + 12) != AUDIO_SAMPLE_RATE) || (data[pos+22] != 16))) {
+			fprintf(stderr, "%s: not 16-bit mono at %luHz\n", path, AUDIO_SAMPLE_RATE);
+			goto done;
+		}
+		if (memcmp(data + pos, "data", 4) == 0) {
+			if (size > n - pos - 8) {
+				size = n - pos - 8;
+			}
+			*len = size / 2;
+			out = malloc((*len ? *len : 1) * sizeof(uint16_t));
+			for (i=0; i<*len; i++) {
+				int16_t v = data[pos + 8 + 2*i] | (data[pos + 9 + 2*i] << 8);
+				out[i] = (v / 16) + 2048;
+			}
+			goto done;
+		}
+		pos += 8 + size + (size & 1);
+	}
+	fprintf(stderr, "%s: no data\n", path);
+done:
+	free(data);
+	fclose(f);
+	return out;
+}
+
+
+/* Compare with the golden samples. Returns 1 if within the
+** tolerance.
+*/
+static int compare(const char* path, unsigned tolerance) {
+
+	uint16_t* golden;
+	size_t len, i, n, differ = 0, first = 0;
+	unsigned err, maxErr = 0;
+	double sq = 0.0;
+
+	golden = read_wav(path, &len);
+	if (!golden) {
+		return 0;
+	}
+	n = (len < numSamples) ? len : numSamples;
+	for (i=0; i<n; i++) {
+		err = abs((int)samples[i] - (int)golden[i]);
+		if (err) {
+			if (differ++ == 0) {
+				first = i;
+			}
+			if (err > maxErr) {
+				maxErr = err;
+			}
+			sq += (double)err * err;
+		}
+	}
+	free(golden);
+
+	printf("golden %s: %zu samples, %zu differ", path, len, differ);
+	if (differ) {
+		printf(" from %zu (%.1fms), max error %u, rms %.3f",
+			first, 1000.0 * first / AUDIO_SAMPLE_RATE, maxErr, sqrt(sq / n));
+	}
+	printf(" (tolerance %u)\n", tolerance);
+	if (len != numSamples) {
+		printf("FAIL: rendered %zu samples, golden has %zu\n", numSamples, len);
+		return 0;
+	}
+	if (maxErr > tolerance) {
+		printf("FAIL: error %u is over the tolerance\n", maxErr);
+		return 0;
+	}
+	return 1;
+}
+
+
+/* Run until the given time in ms from reset */
+static void run_to(uint64_t ms) {
+	if (hal_host_now() < ms*MS) {
+		hal_host_run(ms*MS - hal_host_now(), app_drain);
+	}
+}
+
+/* Play the script. Returns 0 on an error in it. */
+static int play(FILE* f, const char* path) {
+
+	char line[LINE_SIZE], cmd[LINE_SIZE];
+	unsigned long ms, last = 0;
+	unsigned lineNo = 0;
+	int pos;
+	char* arg;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineNo++;
+		line[strcspn(line, "\r\n")] = 0;
+		if ((sscanf(line, " %c", cmd) != 1) || (cmd[0] == '#')) {
+			continue;
+		}
+		if ((sscanf(line, "%lu %s %n", &ms, cmd, &pos) < 2) || (ms < last)) {
+			fprintf(stderr, "%s:%u: bad event\n", path, lineNo);
+			return 0;
+		}
+		last = ms;
+		arg = line + pos;
+		run_to(ms);
+
+		if (strcmp(cmd, "keys") == 0) {
+			hal_host_set_buttons(strtoul(arg, NULL, 0));
+		} else if (strcmp(cmd, "send") == 0) {
+			hal_host_uart_send((const uint8_t*)arg, strlen(arg));
+			hal_host_uart_send((const uint8_t*)"\r", 1);
+		} else if (strcmp(cmd, "end") == 0) {
+			return 1;
+		} else {
+			fprintf(stderr, "%s:%u: unknown event %s\n", path, lineNo, cmd);
+			return 0;
+		}
+	}
+	/* No end: let the last event play out */
+	run_to(last + 1000);
+	return 1;
+}
+
+
+int main(int argc, char** argv) {
+
+	const char* outPath = NULL;
+	const char* goldenPath = NULL;
+	unsigned tolerance = 0;
+	double t0, wall;
+	FILE* f;
+	int opt, ok;
+
+	while ((opt = getopt(argc, argv, "o:g:e:")) != -1) {
+		switch (opt) {
+		case 'o': outPath = optarg; break;
+		case 'g': goldenPath = optarg; break;
+		case 'e': tolerance = atoi(optarg); break;
+		default: optind = argc + 1; break;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-o out.wav] [-g golden.wav] [-e tolerance] script\n",
+			argv[0]);
+		return 2;
+	}
+	f = fopen(argv[optind], "r");
+	if (!f) {
+		perror(argv[optind]);
+		return 2;
+	}
+
+	hal_host_reset();
+	hal_host_on_dac(dac, NULL);
+	t0 = now_ns();
+	app_setup();
+	sei();
+	ok = play(f, argv[optind]);
+	hold_to(samples_due());
+	wall = (now_ns() - t0) / 1e9;
+	fclose(f);
+	if (!ok) {
+		return 2;
+	}
+
+	printf("%s: %zu samples (%.3fs of audio) in %.3fs, %.0f samples/s, %.1fx real time\n",
+		argv[optind], numSamples, (double)numSamples / AUDIO_SAMPLE_RATE, wall,
+		numSamples / wall, (double)numSamples / AUDIO_SAMPLE_RATE / wall);
+
+	if (outPath && !write_wav(outPath)) {
+		return 2;
+	}
+	if (goldenPath && !compare(goldenPath, tolerance)) {
+		return 1;
+	}
+	return 0;
+}
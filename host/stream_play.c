@@ -0,0 +1,172 @@
+/* stream_play.c
+**
+** Host stand-in for a PCM streaming client (stream.h). Runs the
+** firmware on the virtual MCU, raises the baud rate and enters
+** streaming mode through the serial commands, then sends an
+** 8-bit unsigned PCM file, obeying the XON/XOFF bytes sent back.
+** A random pause can be inserted between chunks to exercise the
+** jitter buffer.
+**
+** Reports the underrun/overrun counts and final target printed
+** by the firmware, and the mean time the jitter buffer held. The
+** D2A output can be written out as 8-bit PCM at
+** AUDIO_SAMPLE_RATE.
+**
+** Usage: stream_play [-r rate] [-b baud] [-j max-pause-ms]
+**                    [-o out.raw] file.raw|file.wav
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hal.h"
+#include "app.h"
+#include "notes.h"
+#include "stream.h"
+
+#define CHUNK 8
+#define MS (F_CPU/1000)
+
+static uint8_t xoff;
+static uint8_t xon_seen;
+static FILE* out;
+
+static void uart_tx(uint8_t c, void* ctx) {
+
+	if (c == STREAM_XON) {
+		xoff = 0;
+		xon_seen = 1;
+	} else if (c == STREAM_XOFF) {
+		xoff = 1;
+	} else {
+		putchar(c);
+	}
+}
+
+static void dac(uint16_t sample, void* ctx) {
+	if (out) {
+		fputc(sample >> 4, out);
+	}
+}
+
+static void send(const char* cmd) {
+	hal_host_uart_send((const uint8_t*)cmd, strlen(cmd));
+	while (hal_host_uart_pending()) {
+		hal_host_run(MS, app_drain);
+	}
+	hal_host_run(MS, app_drain);
+}
+
+static uint8_t* load(const char* path, size_t* len) {
+
+	FILE* f = fopen(path, "rb");
+	uint8_t* data;
+	long n;
+
+	if (!f) {
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	n = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	data = malloc(n > 0 ? n : 1);
+	*len = fread(data, 1, n, f);
+	fclose(f);
+
+	/* Skip a canonical WAV header */
+	if ((*len > 44) && (memcmp(data, "RIFF", 4) == 0)) {
+		memmove(data, data + 44, *len - 44);
+		*len -= 44;
+	}
+	return data;
+}
+
+int main(int argc, char** argv) {
+
+	unsigned rate = STREAM_DEFAULT_RATE;
+	unsigned long baud = 250000;
+	unsigned jitter = 0;
+	const char* outPath = NULL;
+	uint8_t* data;
+	size_t len, pos = 0;
+	uint64_t pause_until = 0, start, level_sum = 0, level_n = 0;
+	char cmd[32];
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:b:j:o:")) != -1) {
+		switch (opt) {
+		case 'r': rate = atoi(optarg); break;
+		case 'b': baud = atol(optarg); break;
+		case 'j': jitter = atoi(optarg); break;
+		case 'o': outPath = optarg; break;
+		default: optind = argc + 1; break;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-r rate] [-b baud] [-j max-pause-ms] "
+			"[-o out.raw] file\n", argv[0]);
+		return 1;
+	}
+	data = load(argv[optind], &len);
+	if (!data) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (outPath && !(out = fopen(outPath, "wb"))) {
+		perror(outPath);
+		return 1;
+	}
+	srand(1);
+
+	hal_host_reset();
+	hal_host_on_uart_tx(uart_tx, NULL);
+	hal_host_on_dac(dac, NULL);
+	app_setup();
+	sei();
+	hal_host_run(10*MS, app_drain);
+
+	/* The firmware starts at SERIAL_BAUD; the virtual UART uses
+	** the new rate in both directions as soon as it is set
+	*/
+	snprintf(cmd, sizeof(cmd), "baud %lu\r", baud);
+	send(cmd);
+	snprintf(cmd, sizeof(cmd), "stream %u\r", rate);
+	send(cmd);
+	if (!xon_seen) {
+		fprintf(stderr, "\nno XON from the firmware\n");
+		return 1;
+	}
+
+	/* Feed the file a chunk at a time, 0.1ms steps */
+	start = hal_host_now();
+	while (pos < len) {
+		if (!xoff && !hal_host_uart_pending() && (hal_host_now() >= pause_until)) {
+			size_t n = (len - pos < CHUNK) ? len - pos : CHUNK;
+			hal_host_uart_send(data + pos, n);
+			pos += n;
+			if (jitter && ((rand() & 15) == 0)) {
+				pause_until = hal_host_now() + (uint64_t)(rand() % (jitter + 1)) * MS;
+			}
+		}
+		hal_host_run(MS/10, app_drain);
+		level_sum += stream_level();
+		level_n++;
+	}
+
+	/* Let it play out and time out */
+	while (stream_active) {
+		hal_host_run(MS, app_drain);
+	}
+	hal_host_run(50*MS, app_drain);
+
+	printf("\nsamples %zu in %.3fs (%.3fs of audio), mean buffered %.2fms\n",
+		len, (double)(hal_host_now() - start) / F_CPU, (double)len / rate,
+		level_n ? 1000.0 * level_sum / level_n / rate : 0.0);
+
+	if (out) {
+		fclose(out);
+	}
+	free(data);
+	return (stream_overruns != 0);
+}
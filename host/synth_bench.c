@@ -0,0 +1,168 @@
+/* synth_bench.c
+**
+** Host synthesis throughput benchmark. Runs the firmware on
+** the virtual MCU (hal_host.c) with a four-note chord held on
+** the buttons, for every waveform with and without
+** interpolation, selected through the serial commands. The
+** demo tune is then played to exercise playback.c, followed by
+** a looped recording with one to REC_TRACKS tracks overdubbed.
+**
+** For each case it reports the samples rendered per second of
+** wall-clock time, the speed relative to real time, and the
+** mean wall-clock ns per invocation of each interrupt handler
+** and per rendered sample in the main loop.
+**
+** Usage: synth_bench [seconds-per-case]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hal.h"
+#include "app.h"
+#include "notes.h"
+#include "wavetable.h"
+#include "playback.h"
+
+static uint64_t idle_ns;
+
+static double now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+/* The main loop, timed */
+static void idle(void) {
+	double t0 = now_ns();
+	app_drain();
+	idle_ns += (uint64_t)(now_ns() - t0);
+}
+
+static void send(const char* cmd) {
+	hal_host_uart_send((const uint8_t*)cmd, strlen(cmd));
+	while (hal_host_uart_pending()) {
+		hal_host_run(F_CPU/1000, idle);
+	}
+}
+
+static double per_call(uint8_t vect) {
+	hal_host_isr_stat_t* s = &hal_host_isr_stats[vect];
+	return s->calls ? (double)s->ns / s->calls : 0.0;
+}
+
+/* Play a run of notes on the buttons, 100ms apart */
+static void play_notes(uint8_t first, uint8_t count) {
+	
+	uint8_t i;
+	
+	for (i=0; i<count; i++) {
+		hal_host_set_buttons(1 << ((first + i) & 7));
+		hal_host_run(F_CPU/20, idle);
+		hal_host_set_buttons(0);
+		hal_host_run(F_CPU/20, idle);
+	}
+}
+
+/* Overdub one pass of the loop */
+static void overdub(uint8_t first) {
+	
+	send("dub\r");
+	while (play_dub != PLAY_DUB_RECORDING) {
+		hal_host_run(F_CPU/1000, idle);
+	}
+	play_notes(first, 8);
+	while (play_dub != PLAY_DUB_OFF) {
+		hal_host_run(F_CPU/1000, idle);
+	}
+}
+
+/* Run the firmware for the given virtual time and report */
+static void measure(const char* name, uint8_t interp, double seconds) {
+	
+	uint64_t frames0 = hal_host_dac_frames();
+	uint64_t frames;
+	double t0, wall;
+	
+	memset(hal_host_isr_stats, 0, sizeof(hal_host_isr_stats));
+	idle_ns = 0;
+	hal_host_profile = 1;
+	
+	t0 = now_ns();
+	hal_host_run((uint64_t)(seconds*F_CPU), idle);
+	wall = (now_ns() - t0) / 1e9;
+	
+	hal_host_profile = 0;
+	frames = hal_host_dac_frames() - frames0;
+	
+	printf("%-10s %-6s %12.0f %9.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n",
+		name, interp ? "on" : "off",
+		frames / wall, frames / wall / AUDIO_SAMPLE_RATE,
+		per_call(HAL_VECT_TIMER1_COMPA), per_call(HAL_VECT_TIMER2_COMP),
+		per_call(HAL_VECT_USART0_RX),
+		per_call(HAL_VECT_USART0_UDRE),
+		frames ? (double)idle_ns / frames : 0.0);
+}
+
+int main(int argc, char** argv) {
+	
+	double seconds = (argc > 1) ? atof(argv[1]) : 2.0;
+	uint8_t wave, interp, tracks;
+	char name[16];
+	
+	if (seconds <= 0) {
+		fprintf(stderr, "usage: %s [seconds-per-case]\n", argv[0]);
+		return 1;
+	}
+	
+	hal_host_reset();
+	app_setup();
+	sei();
+	hal_host_run(F_CPU/100, idle);
+	
+	printf("%-10s %-6s %12s %9s %8s %8s %8s %8s %8s\n",
+		"wave", "interp", "samples/s", "xrealtime",
+		"ns/T1", "ns/T2", "ns/RX", "ns/UDRE", "ns/render");
+	
+	for (interp=0; interp<2; interp++) {
+		for (wave=0; wave<NUM_WAVES; wave++) {
+			
+			/* Select the waveform through the serial commands */
+			while (waveform != wave) {
+				send("W ");
+			}
+			if (waveInterpolate != interp) {
+				send("I ");
+			}
+			
+			/* Hold a four-note chord */
+			hal_host_set_buttons(0x0F);
+			measure(wavetable_name(wave), interp, seconds);
+			hal_host_set_buttons(0);
+			hal_host_run(F_CPU/100, idle);
+		}
+	}
+	
+	/* Demo tune through the playback sequencer */
+	send("D ");
+	measure("demo", waveInterpolate, seconds);
+	send("P ");
+	
+	/* A looped recording, adding a track at a time */
+	send("R ");
+	play_notes(0, 8);
+	send("R ");
+	send("loop on\r");
+	send("P ");
+	for (tracks=1; ; tracks++) {
+		snprintf(name, sizeof(name), "loop %ut", tracks);
+		measure(name, waveInterpolate, seconds);
+		if (tracks == REC_TRACKS) {
+			break;
+		}
+		overdub(tracks*2);
+	}
+	
+	return 0;
+}
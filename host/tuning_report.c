@@ -0,0 +1,142 @@
+/* tuning_report.c
+**
+** Host tuning report. For every MIDI key the frequency the
+** firmware plays (midi_phase_inc, as the voices use it) is
+** compared with the exact frequency of the temperament, tuned
+** from the A4 the tables were generated for. The error is in
+** cents; the DDS step quantises each frequency to
+** AUDIO_SAMPLE_RATE/65536 (0.24Hz), so it is largest for the
+** lowest keys.
+**
+** Also checks the buttons' notes (note_phase_inc) over both
+** octaves and the transpose range, and that a transpose is the
+** same table read as the transposed key.
+**
+** Usage: tuning_report [-j] [-k low-key] [-v]
+**   -j  just intonation (on C; see "trans"/"tuning" in cmd.c)
+**   -k  ignore keys below low-key in the maximum (default 24)
+**   -v  print every key
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include "hal.h"
+#include "notes.h"
+#include "tuning.h"
+
+static const char* names[12] = {
+	"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"
+};
+
+/* Just intonation ratios of the degrees above the tonic, as
+** tools/gen_tuning.py
+*/
+static const double justRatio[12] = {
+	1.0, 16.0/15, 9.0/8, 6.0/5, 5.0/4, 4.0/3,
+	45.0/32, 3.0/2, 8.0/5, 5.0/3, 9.0/5, 15.0/8
+};
+
+static double equal_freq(int key) {
+	return tuning_a4_mhz / 1000.0 * pow(2.0, (key - 69) / 12.0);
+}
+
+static double ideal_freq(int key, int just, int tonic) {
+
+	int degree;
+
+	if (!just) {
+		return equal_freq(key);
+	}
+	degree = ((key - tonic) % 12 + 12) % 12;
+	return equal_freq(key - degree) * justRatio[degree];
+}
+
+static double inc_freq(uint16_t inc) {
+	return inc * (double)AUDIO_SAMPLE_RATE / 65536.0;
+}
+
+static double cents(double f, double ideal) {
+	return 1200.0 * log2(f / ideal);
+}
+
+
+int main(int argc, char** argv) {
+
+	int opt, just = 0, verbose = 0, lowKey = 24;
+	int key, n, t, o, worstKey = 0, failures = 0;
+	double c, worst = 0.0, sum = 0.0;
+	static const uint8_t scale[8] = {0, 2, 4, 5, 7, 9, 11, 12};
+
+	while ((opt = getopt(argc, argv, "jk:v")) != -1) {
+		switch (opt) {
+			case 'j': just = 1; break;
+			case 'k': lowKey = atoi(optarg); break;
+			case 'v': verbose = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-j] [-k low-key] [-v]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	note_set_transpose(0);
+	note_set_temperament(just ? TUNING_JUST : TUNING_EQUAL);
+
+	printf("A4 %.3fHz, %s, %luHz sample rate\n", tuning_a4_mhz / 1000.0,
+		just ? "just intonation on C" : "equal temperament", AUDIO_SAMPLE_RATE);
+	if (verbose) {
+		printf("key  note    inc       Hz      ideal   cents\n");
+	}
+	for (key=0; key<TUNING_KEYS; key++) {
+		uint16_t inc = midi_phase_inc(key, 0);
+		double ideal = ideal_freq(key, just, 0);
+
+		c = cents(inc_freq(inc), ideal);
+		if (verbose) {
+			printf("%3d  %-2s%-3d %6u %9.3f %10.3f %+7.3f\n", key,
+				names[key % 12], key/12 - 1, inc, inc_freq(inc), ideal, c);
+		}
+		if (key >= lowKey) {
+			sum += fabs(c);
+			if (fabs(c) > fabs(worst)) {
+				worst = c;
+				worstKey = key;
+			}
+		}
+	}
+	printf("keys %d..%d: mean |error| %.3f cents, max %+.3f cents at %s%d\n",
+		lowKey, TUNING_KEYS-1, sum / (TUNING_KEYS - lowKey), worst,
+		names[worstKey % 12], worstKey/12 - 1);
+
+	/* The buttons' notes, in every octave and transpose. In just
+	** intonation the tonic follows the transpose.
+	*/
+	worst = 0.0;
+	for (t=-NOTE_MAX_TRANSPOSE; t<=NOTE_MAX_TRANSPOSE; t++) {
+		note_set_transpose(t);
+		for (o=0; o<2; o++) {
+			octave = o;
+			for (n=0; n<8; n++) {
+				key = 60 + 12*o + scale[n] + t;
+				if (note_phase_inc(n) != midi_phase_inc(60 + 12*o + scale[n], 0)) {
+					failures++;
+				}
+				c = cents(inc_freq(note_phase_inc(n)),
+					ideal_freq(key, just, ((t % 12) + 12) % 12));
+				if (fabs(c) > fabs(worst)) {
+					worst = c;
+				}
+			}
+		}
+	}
+	octave = 0;
+	note_set_transpose(0);
+	printf("buttons, transpose %d..%d: max %+.3f cents\n",
+		-NOTE_MAX_TRANSPOSE, NOTE_MAX_TRANSPOSE, worst);
+	if (failures) {
+		printf("FAIL: %d button notes differ from their MIDI keys\n", failures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,84 @@
+/* keys.c
+**
+** Debounced push button scanner and key event queue.
+*/
+
+#include "hal.h"
+#include "sched.h"
+#include "keys.h"
+
+volatile uint8_t keys_state = 0;
+volatile uint8_t keys_dropped = 0;
+
+/* Integrator per key, 0..KEY_DEBOUNCE_MS */
+static uint8_t keyCount[KEY_COUNT];
+
+/* Event queue. The indices run freely and are masked on
+** access; keys_scan only writes keyHead and keys_pop only
+** writes keyTail.
+*/
+static volatile key_event_t keyQueue[KEY_QUEUE_SIZE];
+static volatile uint8_t keyHead = 0;
+static volatile uint8_t keyTail = 0;
+
+
+static void keys_push(uint8_t key, uint8_t pressed, uint16_t time) {
+	
+	volatile key_event_t* ev;
+	
+	if ((uint8_t)(keyHead - keyTail) >= KEY_QUEUE_SIZE) {
+		keys_dropped++;
+		return;
+	}
+	ev = &keyQueue[keyHead & KEY_QUEUE_MASK];
+	ev->time = time;
+	ev->key = key;
+	ev->pressed = pressed;
+	keyHead++;
+}
+
+
+void keys_scan(void) {
+	
+	uint8_t pins = hal_buttons_read();
+	uint8_t state = keys_state;
+	uint16_t now = sched_ms;
+	uint8_t i, mask;
+	
+	for (i=0, mask=1; i<KEY_COUNT; i++, mask<<=1) {
+		
+		/* Integrate towards the sampled level */
+		if (pins & mask) {
+			if (keyCount[i] < KEY_DEBOUNCE_MS) {
+				keyCount[i]++;
+			}
+		} else if (keyCount[i] > 0) {
+			keyCount[i]--;
+		}
+		
+		/* Change state only at either end of the range */
+		if ((keyCount[i] == KEY_DEBOUNCE_MS) && !(state & mask)) {
+			state |= mask;
+			keys_push(i, 1, now);
+		} else if ((keyCount[i] == 0) && (state & mask)) {
+			state &= ~mask;
+			keys_push(i, 0, now);
+		}
+	}
+	keys_state = state;
+}
+
+
+uint8_t keys_pop(key_event_t* ev) {
+	
+	volatile key_event_t* q = &keyQueue[keyTail & KEY_QUEUE_MASK];
+	
+	if (keyTail == keyHead) {
+		return 0;
+	}
+	ev->time = q->time;
+	ev->key = q->key;
+	ev->pressed = q->pressed;
+	keyTail++;
+	return 1;
+}
@@ -0,0 +1,44 @@
+/* keys.h
+**
+** Debounced push button scanner. keys_scan() samples the
+** buttons on port A every 1ms and runs a per-key integrator:
+** a key's count moves one step towards the sampled level each
+** scan, and the key only changes state when the count reaches
+** 0 or KEY_DEBOUNCE_MS. Each change is queued as an event
+** carrying its millisecond timestamp.
+**
+** The event queue is single-producer (keys_scan) and
+** single-consumer (keys_pop).
+*/
+
+#ifndef KEYS_H
+#define KEYS_H
+
+#define KEY_COUNT 8
+#define KEY_DEBOUNCE_MS 4
+
+/* Power of two */
+#define KEY_QUEUE_SIZE 16
+#define KEY_QUEUE_MASK (KEY_QUEUE_SIZE-1)
+
+typedef struct {
+	uint16_t time;		//sched_ms when the change was accepted
+	uint8_t key;		//0..7
+	uint8_t pressed;	//1=press, 0=release
+} key_event_t;
+
+/* Debounced state, bit n set while key n is held */
+extern volatile uint8_t keys_state;
+
+/* Events lost because the queue was full */
+extern volatile uint8_t keys_dropped;
+
+/* Sample the buttons and queue any debounced changes
+** (1ms task)
+*/
+void keys_scan(void);
+
+/* Take the oldest event. Returns 0 if there are none. */
+uint8_t keys_pop(key_event_t* ev);
+
+#endif
@@ -1,18 +1,15 @@
 /* led.c
 **
 ** Handles operations for the blinking onboard LD0
-** on PORTE, bit4, synchronized to a 120bpmbeat.
-** Sets up port values and toggles LED for 20% of the
-** millisecond-stepped interval.
+** on PORTE, bit4, synchronized to the beat clock
+** (tempo.h). Sets up port values and lights the LED
+** for the first sixteenth of each beat.
 */
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
+#include "hal.h"
+#include "led.h"
 
-void ledWrite(uint8_t on);
-
-/* Remember the current beat cycle/LED state */
-volatile int beatCount = 0;
+/* Remember the LED state */
 volatile uint8_t ledOn = 0;
 
 
@@ -21,34 +18,15 @@ volatile uint8_t ledOn = 0;
 void setup_led(void) {
 	
 	/* Setup the data direction register for portE (LED) */
-	DDRE = 0xFF;
+	hal_led_setup();
 }
 
 
-/* Incrementing the on/off timer */
-void beatStep(void) {
-	
-	/* Beat Handler
-	** This interrupt firing 1000times/sec
-	** 60,000times/minute
-	** 120bpm = 2bps
-	** 500clocks delay
-	** but the light is on for 20% of a beat
-	** 500*0.2 = 100clocks */
-	
-	/* Count beats */
-	beatCount++;
-	if (beatCount==499) {
-		beatCount = 0;
-	}
-	
-	/* LED on/off */
-	if (beatCount<100) {
-		ledWrite(1);
-	}
-	else {
-		ledWrite(0);
-	}
+/* Beat clock subscriber (tempo.h): light the LED for the
+** first tick of each beat
+*/
+void led_tick(uint8_t tick) {
+	ledWrite(tick == 0);
 }
 
 
@@ -56,13 +34,7 @@ void beatStep(void) {
 void ledWrite(uint8_t on) {
 	
 	/* Toggle portE, bit4 without changing other bits */
-	if (on==1) {
-		PORTE |= (1<<4);
-		ledOn = 1;
-	}
-	else {
-		PORTE &= 0xEF; //andi 11101111=239, bit mask
-		ledOn = 0;
-	}
+	hal_led_write(on);
+	ledOn = on;
 
 }
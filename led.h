@@ -1,23 +1,22 @@
 /* led.h
 **
 ** Handles operations for the blinking onboard LD0
-** on PORTE, bit4, synchronized to a 120bpmbeat.
-** Sets up port values and toggles LED for 20% of the
-** millisecond-stepped interval.
+** on PORTE, bit4, synchronized to the beat clock
+** (tempo.h). Sets up port values and lights the LED
+** for the first sixteenth of each beat.
 */
 
 #ifndef LED_H
 #define LED_H
 
 /* LED State */
-volatile int beatCount;
-volatile uint8_t ledOn;
+extern volatile uint8_t ledOn;
 
 /* Configure the LED port for In/Out */
 void setup_led(void);
 
-/* Incrementing the on/off timer */
-void beatStep(void);
+/* Beat clock subscriber */
+void led_tick(uint8_t tick);
 
 /* Writing to the port */
 void ledWrite(uint8_t on);
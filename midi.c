@@ -0,0 +1,150 @@
+/* midi.c
+**
+** MIDI input: running-status parser and event queue (see
+** midi.h).
+*/
+
+#include "hal.h"
+#include "notes.h"
+#include "voice.h"
+#include "serial.h"
+#include "midi.h"
+
+volatile uint8_t midi_active = 0;
+volatile uint8_t midi_dropped = 0;
+volatile uint16_t midi_events = 0;
+
+/* Parser state: the running status (0 if none), and the first
+** data byte while waiting for the second
+*/
+static uint8_t midiStatus = 0;
+static uint8_t midiData1 = 0;
+static uint8_t midiHaveData1 = 0;
+
+/* Event queue. The indices run freely and are masked on
+** access; midi_rx only writes midiHead and midi_poll only
+** writes midiTail.
+*/
+static volatile midi_event_t midiQueue[MIDI_QUEUE_SIZE];
+static volatile uint8_t midiHead = 0;
+static volatile uint8_t midiTail = 0;
+
+
+void midi_start(void) {
+
+	quiet();
+	midi_active = 1;
+	serial_set_baud(MIDI_BAUD);
+}
+
+
+static void midi_push(uint8_t status, uint8_t data1, uint8_t data2) {
+
+	volatile midi_event_t* ev;
+
+	if ((uint8_t)(midiHead - midiTail) >= MIDI_QUEUE_SIZE) {
+		midi_dropped++;
+		return;
+	}
+	ev = &midiQueue[midiHead & MIDI_QUEUE_MASK];
+	ev->status = status;
+	ev->data1 = data1;
+	ev->data2 = data2;
+	midiHead++;
+}
+
+
+void midi_rx(uint8_t c) {
+
+	uint8_t status;
+
+	/* Real time messages may appear anywhere, even between
+	** the data bytes of another message, and carry no data
+	*/
+	if (c >= 0xF8) {
+		return;
+	}
+
+	/* A status byte starts a message. System exclusive and
+	** system common messages cancel the running status, so
+	** their data bytes are skipped.
+	*/
+	if (c & 0x80) {
+		midiStatus = (c < 0xF0) ? c : 0;
+		midiHaveData1 = 0;
+		return;
+	}
+	if (midiStatus == 0) {
+		return;
+	}
+
+	/* Program change and channel pressure have one data
+	** byte, every other channel message has two
+	*/
+	status = midiStatus & 0xF0;
+	if (((status & 0xE0) != 0xC0) && !midiHaveData1) {
+		midiData1 = c;
+		midiHaveData1 = 1;
+		return;
+	}
+	midiHaveData1 = 0;
+
+	/* Complete message; the status stays for the next one */
+	switch (status) {
+	case MIDI_NOTE_OFF:
+	case MIDI_NOTE_ON:
+	case MIDI_PITCH_BEND:
+		midi_push(status, midiData1, c);
+		break;
+	case MIDI_CONTROL:
+		if (midiData1 >= MIDI_CC_MODE) {
+			midi_push(status, midiData1, c);
+		}
+		break;
+	}
+}
+
+
+uint8_t midi_pending(void) {
+	return midiTail != midiHead;
+}
+
+
+void midi_poll(void) {
+
+	midi_event_t ev;
+	volatile midi_event_t* q;
+
+	while (midiTail != midiHead) {
+		q = &midiQueue[midiTail & MIDI_QUEUE_MASK];
+		ev.status = q->status;
+		ev.data1 = q->data1;
+		ev.data2 = q->data2;
+		midiTail++;
+
+		switch (ev.status) {
+		case MIDI_NOTE_ON:
+			/* Velocity 0 is a note off */
+			if (ev.data2 != 0) {
+				voice_midi_on(ev.data1, ev.data2);
+				break;
+			}
+			/* fall through */
+		case MIDI_NOTE_OFF:
+			voice_midi_off(ev.data1);
+			break;
+		case MIDI_PITCH_BEND:
+			/* 14 bits, centre 0x2000 */
+			voice_midi_bend((int16_t)(((uint16_t)ev.data2 << 7) | ev.data1) - 0x2000);
+			break;
+		case MIDI_CONTROL:
+			if (ev.data1 == MIDI_CC_SOUND_OFF) {
+				voice_all_off();
+			} else if (ev.data1 == MIDI_CC_NOTES_OFF) {
+				quiet();
+			}
+			break;
+		}
+		midi_events++;
+	}
+}
@@ -0,0 +1,66 @@
+/* midi.h
+**
+** MIDI input mode. The UART runs at 31250 baud and every
+** received byte goes through a running-status parser in the
+** receive interrupt, which takes constant time per byte and
+** keeps no more state than the current status and first data
+** byte. Note On/Off, pitch bend and the All Sound/Notes Off
+** controllers are queued as events, and applied to the voice
+** pool from the main loop by midi_poll(). All channels are
+** accepted; other messages, system exclusive and real time
+** bytes are skipped.
+**
+** The event queue is single-producer (receive interrupt) and
+** single-consumer (midi_poll).
+*/
+
+#ifndef MIDI_H
+#define MIDI_H
+
+#define MIDI_BAUD 31250
+
+#define MIDI_QUEUE_SIZE 16
+#define MIDI_QUEUE_MASK (MIDI_QUEUE_SIZE-1)
+
+/* Status bytes, without the channel */
+#define MIDI_NOTE_OFF 0x80
+#define MIDI_NOTE_ON 0x90
+#define MIDI_CONTROL 0xB0
+#define MIDI_PITCH_BEND 0xE0
+
+/* Channel mode controllers 120..127; 120 (All Sound Off) stops
+** every voice at once and 123 (All Notes Off) releases them
+*/
+#define MIDI_CC_MODE 120
+#define MIDI_CC_SOUND_OFF 120
+#define MIDI_CC_NOTES_OFF 123
+
+typedef struct {
+	uint8_t status;		//MIDI_NOTE_ON etc.
+	uint8_t data1;
+	uint8_t data2;
+} midi_event_t;
+
+extern volatile uint8_t midi_active;
+
+/* Events lost because the queue was full */
+extern volatile uint8_t midi_dropped;
+
+/* Events applied to the voice pool since reset */
+extern volatile uint16_t midi_events;
+
+/* Release all voices and switch the UART to MIDI_BAUD. MIDI
+** mode lasts until reset.
+*/
+void midi_start(void);
+
+/* Parse a received byte - serial receive interrupt only */
+void midi_rx(uint8_t c);
+
+/* Apply queued events to the voice pool - main loop */
+void midi_poll(void);
+
+/* Nonzero if events are waiting for midi_poll */
+uint8_t midi_pending(void);
+
+#endif
@@ -1,171 +1,227 @@
 /* notes.c
 */
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <math.h>
+#include "hal.h"
 #include "d2a.h"
 #include "led.h"
 #include "serial.h"
-
-void quiet(void);
+#include "notes.h"
+#include "tuning.h"
+#include "voice.h"
+#include "wavetable.h"
 
 /* Global variables for the waveform generator */
 volatile uint8_t waveform = 0;
-volatile uint8_t upWave = 1;//for triangle wave
-volatile uint8_t sinWaveStep = 0;
-volatile float amplitude = 0;
 volatile uint8_t note = 255;//no note
 volatile uint8_t triWaveSteps = 8;
 volatile uint8_t octave = 0;
 
+volatile int8_t transpose = 0;
+volatile uint8_t temperament = TUNING_EQUAL;
+
+/* The tuning table for the temperament and transpose */
+static uint8_t tuningTable = 0;
+
+/* MIDI keys of the buttons' notes, c4..c5 */
+#define NOTE_KEY_C4 60
+static const uint8_t noteKeys[8] PROGMEM = {0, 2, 4, 5, 7, 9, 11, 12};
+
 
 /* Setup timer 1 to generate an interrupt when output compare 
 ** match A happens. Global interrupts will have to be 
-** enabled also.
+** enabled also. The interrupt handler is in audio.c.
 */
 void setup_note_timer(void) {
-	TIMSK |= (1<<OCIE1A);
+	
+	/* Load the initial waveform */
+	wavetable_select(waveform);
+	
+	/* Set up timer so that it resets on output compare match
+	** and is clocked by the system clock. This turns the timer
+	** on - so the interrupt handler will fire at
+	** AUDIO_SAMPLE_RATE. It runs continuously; silence is
+	** simply rendered as mid-scale samples.
+	*/
+	hal_audio_timer_setup(AUDIO_TIMER_TOP);
 }
 
-/* Play a note.
-**
-** Setup timer 1 to generate an interrupt at twice the frequency
-** of the desired note for square waves, and twice*no. of steps
-** for triangular waves. We then change the value being sent to 
-** the D2A. Timer 1 is configured to count the system clock
-** and to reset on output compare match.
+/* Select the tuning table. Just intonation is on the key
+** the buttons' scale is transposed to.
 */
-void start_note(void) 
-{
-	uint16_t clockVal = 0;
-	const uint16_t noteClocks[] = {15287,13620,12133,11452,10203,9089,8098,7643};
+static void tuning_select(void) {
 	
-	/* Select precalculated clock times matching a note
-	** length for the compare register. 
-	** period=1/(frequency)
-	** clocksteps=8MHz *period
-	**/
-	//c4 261.30hz	//d4 293.66hz	//e4 329.63hz	//f4 349.23hz
-	//g4 392.00hz	//a4 440.00hz	//b4 493.88hz	//c5 523.25hz
+	int8_t tonic = transpose % 12;
 	
-	if (note<=7) {
-		clockVal = noteClocks[note];
-	} else {
-		quiet();
-		return;
+	if (tonic < 0) {
+		tonic += 12;
 	}
+	tuningTable = (temperament==TUNING_JUST) ? 1 + tonic : 0;
+}
+
+void note_set_transpose(int8_t semitones)
+{
+	transpose = semitones;
+	tuning_select();
+}
+
+void note_set_temperament(uint8_t t)
+{
+	temperament = t;
+	tuning_select();
+}
+
+/* Phase increment of MIDI key k, transposed (limited to the
+** table)
+*/
+static uint16_t key_inc(int16_t k)
+{
+	k += transpose;
+	if (k < 0) {
+		k = 0;
+	} else if (k >= TUNING_KEYS) {
+		k = TUNING_KEYS-1;
+	}
+	return pgm_read_word(&tuningPhaseInc[tuningTable][k]);
+}
+
+/* Phase increment for note n (0..7) in the current octave */
+uint16_t note_phase_inc(uint8_t n)
+{
+	return key_inc(NOTE_KEY_C4 + 12*octave + pgm_read_byte(&noteKeys[n]));
+}
+
+/* Phase increment of MIDI key 0..127 bent by bend/256
+** semitones. Bends are interpolated linearly between the
+** neighbouring keys, which is within a cent.
+*/
+uint16_t midi_phase_inc(uint8_t key, int16_t bend)
+{
+	int32_t pos;
+	uint8_t frac;
+	uint16_t a, b;
 	
-	/* Allow for waveforms: divide by no. steps needed
-	** then subtract 1, as clk starts at 0 */
-	if (waveform==1) clockVal = clockVal/(triWaveSteps);
-	if (waveform==2) clockVal = clockVal/(16);
-	if (octave==1) clockVal = clockVal/2;
-		//if (waveform==0) clockVal = clockVal;
-	clockVal--;
-	
-	/* Write to the timer compare register */
-	OCR1A = clockVal;
+	pos = ((int32_t)key << 8) + bend;
+	if (pos < 0) {
+		pos = 0;
+	} else if (pos > ((int32_t)(TUNING_KEYS-1) << 8)) {
+		pos = (int32_t)(TUNING_KEYS-1) << 8;
+	}
+	key = pos >> 8;
+	frac = pos & 0xFF;
+	a = key_inc(key);
+	if (frac==0) {
+		return a;
+	}
+	b = key_inc(key+1);
+	return a + (int16_t)(((int32_t)((int16_t)(b - a)) * frac) >> 8);
+}
+
+/* Play the current note on its own, releasing any other
+** voices (used for playback of recordings and the demo tune).
+*/
+void start_note(void) 
+{
+	voice_release_all();
 	
-	/* Set up timer so that it resets on output compare match
-	** and is clocked by the system clock. This turns the timer
-	** on - so the interrupt handler will fire when it reaches
-	** the output compare value - and sound will be generated.
-	*/
-	TCCR1B = (1<<WGM12)|(1<<CS10);
+	if (note<=7) {
+		voice_note_on(note);
+	}
 }
 
 
-/* Set the currently used note waveform 
+/* Set the currently used note waveform (WAVE_ numbers in
+** wavetable.h). This applies to every voice, so held notes
+** carry on with the new waveform.
  */
 void set_waveform(uint8_t wavetype) {
-	//0==square, 1==triangle, 2=sin
-
-	/* Stop the current note */
-	quiet();
 	
 	/* Toggle the waveform */
 	if (waveform != wavetype) {
 		waveform = wavetype;
 	} else {
-		waveform = 0;
+		waveform = WAVE_SQUARE;
 	}
 	
-	/* Continue the current note */
-	start_note();
+	/* Load its table */
+	wavetable_select(waveform);
 }
 
-/* Turn off timer 1 - so no interrupts will fire
-** and no sound will be generated. */
+/* Release all voices - this will stop all sound */
 void quiet(void)
 {
-	TCCR1B = 0;
-	/* reset amplitude in case of waveform changes before
-	** next tone */
-	amplitude = 0;
-	upWave = 1;
-	sinWaveStep = 0;
+	voice_release_all();
 }
 
 
-/* Interrupt service routine for our note timer.
+/* Render n samples (n <= AUDIO_BLOCK) of all active voices
+** into buf. Voices are rendered one at a time over the whole
+** block, so each voice's state stays in registers. Each voice
+** is centred on zero and scaled to +-1024 (VOICE_SHIFT), then
+** by its amplitude (velocity and envelope, set at the 1ms
+** control rate), so two full-scale voices just fill the 12-bit D2A
+** range; louder sums are saturated to 0..4095.
+**
+** Called from the main loop, which also makes every voice
+** change (voice.h), so each voice is read and its phase
+** written back directly.
 */
-ISR(TIMER1_COMPA_vect)
+void synth_render(uint16_t* buf, uint8_t n)
 {
-	/* Implement wave output. This interrupt
-	** handler is called at twice the frequency
-	** of the sound being output for square waves,
-	** and 32x for triangle/sin waves.
-	**
-	** Timing is handled by start_note.
-	*/
-	
-	/* Precalculated amplitudes for 32-step sin waves,
-	** equivalent to 16 step triangular waves.
-	** Precalculation saves processing time.
-	*/
-	const uint8_t sinAmplitude[32] = {128,176,218,246,255,246,218,176,128,79,37,9,0,9,37,79,127,176,218,246,255,246,218,176,128,79,37,9,0,9,37,79};
+	int16_t* mix = (int16_t*)buf;
+	int16_t sum, s;
+	uint16_t ph, inc, level;
+	uint8_t i, j, p, frac, amplitude, next, amp;
+	uint8_t interp = waveInterpolate;
 	
-	/* Square waveform processing */
-	if (waveform==0) {
-		amplitude = 255 - amplitude;
+	for (j=0; j<n; j++) {
+		mix[j] = 0;
 	}
 	
-	/* Triangle waveform processing */
-	if (waveform==1) {
+	for (i=0; i<NUM_VOICES; i++) {
 		
-		/* Increase/Decrease amplitude */
-		if (upWave==1) {
-			amplitude += 256.0/triWaveSteps;
-		} else {
-			amplitude -= 256.0/triWaveSteps;
+		if (!voices[i].active) {
+			continue;
 		}
+		ph = voices[i].phase;
+		inc = voices[i].inc;
+		amp = voices[i].amp;
 		
-		/* Check for upper/lower amplitude */
-		if (amplitude>254) {
-			amplitude = 255;
-			upWave = 0;
+		for (j=0; j<n; j++) {
+			ph += inc;
+			p = ph >> 8;
+			
+			/* Every waveform is a lookup in the active table */
+			amplitude = waveTable[p];
+			level = (uint16_t)amplitude << 8;
+			if (interp) {
+				/* Blend towards the next entry by the phase
+				** fraction, keeping the 8 fractional bits
+				*/
+				next = waveTable[(uint8_t)(p+1)];
+				frac = ph & 0xFF;
+				if (next >= amplitude) {
+					level += (uint16_t)(uint8_t)(next - amplitude) * frac;
+				} else {
+					level -= (uint16_t)(uint8_t)(amplitude - next) * frac;
+				}
+			}
+			s = (int16_t)(level >> (8-VOICE_SHIFT)) - (128<<VOICE_SHIFT);
+			
+			/* Envelope and velocity, one multiply */
+			if (amp != VOICE_GAIN_FULL) {
+				s = ((int32_t)s * amp) >> 8;
+			}
+			mix[j] += s;
 		}
-		if (amplitude<1) {
-			amplitude = 0;
-			upWave = 1;
-		}
-	}
-	
-	/* Sine waveform processing */
-	if (waveform==2) {
 		
-		/* Increase the wave position counter */
-		sinWaveStep++;
-		if (sinWaveStep>=32) {
-			sinWaveStep = 0;
-		}
-		
-		/* Read the amplitude */
-		amplitude = sinAmplitude[sinWaveStep];
+		voices[i].phase = ph;
 	}
 	
-	
-	/* Play tone */
-	d2a_output((uint8_t)round(amplitude));
+	/* Saturate and offset to the D2A range */
+	for (j=0; j<n; j++) {
+		sum = mix[j];
+		if (sum > D2A_MAX-D2A_MIDSCALE) sum = D2A_MAX-D2A_MIDSCALE;
+		if (sum < -D2A_MIDSCALE) sum = -D2A_MIDSCALE;
+		buf[j] = (uint16_t)(sum + D2A_MIDSCALE);
+	}
 }
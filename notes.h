@@ -6,17 +6,28 @@
 #ifndef NOTES_H
 #define NOTES_H
 
+/* Fixed audio sample rate. Timer 1 fires once per sample,
+** every 512 clocks at 8MHz.
+*/
+#define AUDIO_SAMPLE_RATE 15625UL
+#define AUDIO_TIMER_TOP ((F_CPU/AUDIO_SAMPLE_RATE)-1)
+
+/* 8-bit waveform samples are shifted left by VOICE_SHIFT to
+** give each voice +-1024 in the 12-bit mix.
+*/
+#define VOICE_SHIFT 3
+
 /* Globally accessible variables managing the current
 ** note and waveform
 */
-volatile uint8_t waveform;
-volatile uint8_t note;
-volatile uint8_t tunePlaying;
-volatile uint8_t triWaveSteps;
-volatile uint8_t octave;
+extern volatile uint8_t waveform;
+extern volatile uint8_t note;
+extern volatile uint8_t tunePlaying;
+extern volatile uint8_t triWaveSteps;
+extern volatile uint8_t octave;
 
-/* Setup the AVR timer that we will use to time our 
-** notes. See the interrupt handler in notes.c for
+/* Setup and start the AVR timer that we will use to clock
+** our audio samples. See the interrupt handler in notes.c for
 ** what happens on each interrupt.
 */
 void setup_note_timer(void);
@@ -25,14 +36,35 @@ void setup_note_timer(void);
  */
 void set_waveform(uint8_t wavetype);
 
-/* Write the timer compare length for the selected note
+/* Play the current note alone on the voice pool
 */
 void start_note(void);
 
-/* Stop the note timer - this will stop all sound 
+/* Release all voices - sound stops when their envelopes'
+** release ends
 */
 void quiet(void);
 
+/* Tuning: semitones added to every note, and the temperament
+** (TUNING_EQUAL or TUNING_JUST, see tuning.h)
+*/
+#define NOTE_MAX_TRANSPOSE 24
+extern volatile int8_t transpose;
+extern volatile uint8_t temperament;
+void note_set_transpose(int8_t semitones);
+void note_set_temperament(uint8_t t);
+
+/* Phase increment of note n in the current octave */
+uint16_t note_phase_inc(uint8_t n);
+
+/* Phase increment of MIDI key 0..127 (transposed), bent by
+** bend/256 semitones
+*/
+uint16_t midi_phase_inc(uint8_t key, int16_t bend);
+
+/* Render n 12-bit output samples from all active voices */
+void synth_render(uint16_t* buf, uint8_t n);
+
 /* Playing twinkle, twinkle little star
  */
 void demoTuneStart(void);
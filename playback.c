@@ -1,107 +1,358 @@
 /* playback.c
+**
+** Recordings are kept as a stream of events in rec_buffer.
+** Each event is the time in ms since the previous event (or
+** the start of the recording) as a variable length quantity,
+** followed by one byte holding the note (bits 0..6) and
+** whether it was pressed (REC_PRESS) or released. A note's
+** duration is the time to its release event.
+**
+** The delta uses 7 bits per byte, most significant first, with
+** bit 7 set on every byte but the last (as in MIDI files), so
+** most events take 2 or 3 bytes. Gaps between key events are
+** timed to 65.5s, and a track's closing gap (padding an overdub
+** out to the loop length) may be longer, so loops are not limited
+** to 65.5s. Appending is O(1); playback decodes forward
+** with a read cursor, leaving the recording intact.
+**
+** Each event's deadline is computed once, when it is decoded,
+** by scaling its delta by the tempo and adding it to the
+** previous deadline. Deadlines are in 1/256ms so that scaling
+** doesn't drift. Each tick only advances the playback clock and
+** compares it with the next deadline of each track.
+**
+** A recording holds up to REC_TRACKS tracks one after another,
+** each ending with REC_END. The tracks share one timeline: a
+** pass ends when the first track does, and every track starts
+** again with the next pass. An overdub records a new track for
+** exactly one pass while the others play, and appends it. The
+** tracks' notes share the voice pool, which mixes them.
 */
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include "led.h"
+#include "hal.h"
+#include "playback.h"
+#include "bench.h"
+#include "tempo.h"
 #include "notes.h"
+#include "serial.h"
+#include "sched.h"
+#include "store.h"
+#include "timer2.h"
+#include "voice.h"
+#include "wavetable.h"
 
-/* Global variables for the buffers */
-#define NOTE_BUFSIZE 24
-volatile uint8_t note_buffer[24] = {111};
-volatile uint8_t bytes_in_notebuffer = 0;
-volatile uint8_t time_buffer[24];
-	//time buffers count with 10ms groupings
+/* Global variables for the buffer */
+uint8_t rec_buffer[REC_BUFSIZE];
+volatile uint16_t rec_length = 0;
+	//bytes used in rec_buffer
+volatile uint8_t rec_tracks = 0;
+	//tracks found by the last tracks_scan
+
+/* A track being played */
+typedef struct {
+	uint16_t start;		//first event in rec_buffer
+	uint16_t end;		//just past its REC_END
+	uint16_t pos;		//read cursor
+	uint32_t due;		//deadline of the next event, 1/256ms from the pass start
+	uint8_t event;		//the next event
+	uint8_t held;		//notes held by this track
+} track_t;
+
+#define TRACK_DONE 0xFFFFFFFFUL
 
 /* Global variables for playback */
-volatile uint8_t playback_counter = 0;
-	//counts time between notes
-volatile uint8_t playback_noteSpace = 0;
-	//stores the current note's length
+static track_t tracks[REC_TRACKS];
+static uint8_t play_tracks = 0;
+	//tracks being played
+static uint32_t base_length = 0;
+	//recorded ms of the first track, the loop length
+static uint32_t play_clock = 0;
+	//ms since the pass started
+static uint16_t play_last = 0;
+	//sched_ms when play_clock was last advanced
+static uint16_t play_step = REC_TEMPO_STEP(100);
+	//1/256ms per recorded ms
 volatile uint8_t tuneWait = 255;
 	//0=play,1=waitForBeat,255=idle
+volatile uint8_t play_loop = 0;
+volatile uint16_t play_tempo = 100;
+play_stat_t play_stats[REC_TRACKS+1];
+
+/* Global variables for overdubbing */
+volatile uint8_t play_dub = PLAY_DUB_OFF;
+static uint16_t dub_start = 0;
+	//rec_length before the new track
+static uint32_t dub_length = 0;
+	//recorded ms of the new track so far
 
 /* Global variables for note recording */
 volatile uint8_t rec_waveform = 0;
-volatile uint16_t rec_timecounter = 0;
+volatile uint16_t rec_lasttime = 0;
 volatile uint16_t rec_beatset = 0;
 volatile uint8_t recording = 0;
 volatile uint8_t rec_octave = 0;
 volatile uint8_t tmp_octave = 0;
 volatile uint8_t tmp_waveform = 0;
 
+/* The demo tune, one beat per note
+** C:0 D:1 E:2 F:3 G:4 A:5 B:6 C:7 rest:255 EoF:111
+*/
+static const uint8_t twinkleSong[] PROGMEM = {
+	0,0,4,4,5,5,4,255,3,3,2,2,1,1,0,255,111
+};
+
+
+/* Append an event, returning 0 if it does not fit */
+static uint8_t rec_append(uint8_t event, uint32_t delta) {
+
+	uint8_t len;
+
+	len = (delta < 0x80) ? 2 : (delta < 0x4000) ? 3 : (delta < 0x200000) ? 4 : 5;
+	if (rec_length + len > REC_BUFSIZE) {
+		return 0;
+	}
+	if (delta >= 0x200000) {
+		rec_buffer[rec_length++] = 0x80 | ((delta >> 21) & 0x7F);
+	}
+	if (delta >= 0x4000) {
+		rec_buffer[rec_length++] = 0x80 | ((delta >> 14) & 0x7F);
+	}
+	if (delta >= 0x80) {
+		rec_buffer[rec_length++] = 0x80 | ((delta >> 7) & 0x7F);
+	}
+	rec_buffer[rec_length++] = delta & 0x7F;
+	rec_buffer[rec_length++] = event;
+	return 1;
+}
+
+
+/* Decode the delta at *pos */
+static uint32_t read_delta(uint16_t* pos) {
+
+	uint32_t delta = 0;
+	uint8_t c;
+
+	do {
+		c = rec_buffer[(*pos)++];
+		delta = (delta << 7) | (c & 0x7F);
+	} while (c & 0x80);
+	return delta;
+}
+
+
+/* Decode a track's next event, and schedule it after the
+** previous one at the current tempo. A track without a
+** REC_END ends where the buffer does.
+*/
+static void play_read(track_t* t) {
+
+	if (t->pos >= t->end) {
+		t->event = REC_END;
+		return;
+	}
+	t->due += read_delta(&t->pos) * play_step;
+	t->event = rec_buffer[t->pos++];
+}
+
+
+/* Find the tracks in the recording, and the first one's length */
+void tracks_scan(void) {
+
+	uint16_t pos = 0;
+	uint32_t length = 0;
+	track_t* t;
+
+	rec_tracks = 0;
+	while ((pos < rec_length) && (rec_tracks < REC_TRACKS)) {
+		t = &tracks[rec_tracks];
+		t->start = pos;
+		do {
+			length += read_delta(&pos);
+		} while ((rec_buffer[pos++] != REC_END) && (pos < rec_length));
+		t->end = pos;
+		if (rec_tracks == 0) {
+			base_length = length;
+		}
+		rec_tracks++;
+	}
+}
+
+
+/* Start a pass of every track, frac 1/256ms after the pass
+** start
+*/
+static void pass_start(uint8_t frac) {
+
+	uint8_t i;
+	track_t* t;
+
+	for (i=0; i<play_tracks; i++) {
+		t = &tracks[i];
+		t->pos = t->start;
+		t->due = frac;
+		t->held = 0;
+		play_read(t);
+	}
+}
+
+
+/* Notes held by all the tracks */
+static uint8_t tracks_held(void) {
+
+	uint8_t i, held = 0;
+
+	for (i=0; i<play_tracks; i++) {
+		held |= tracks[i].held;
+	}
+	return held;
+}
+
+
+void playback_set_tempo(uint16_t percent) {
+	/* Takes effect from the next deadline computed */
+	play_tempo = percent;
+	play_step = REC_TEMPO_STEP(percent);
+}
+
+
 /* Playback */
 void playBuffer(void) {
-	
+
 	/* Set state */
-	playback_counter = 0;
-	playback_noteSpace = time_buffer[0];
+	tracks_scan();
+	play_tracks = rec_tracks;
+	play_clock = 0;
+	pass_start(0);
 	tuneWait = 1;
-	
+
 	tmp_octave = octave;
 	octave = rec_octave;
-	
+
 	tmp_waveform = waveform;
 	waveform = rec_waveform;
-	
+	wavetable_select(waveform);
+
 }
 
 
-void buffer_note(uint8_t n, uint8_t t) {
-	/* Procedure to output a note/time (adding it to the outgoing buffers)
-	 ** (The values will get consumed one at a time on the 1ms timer)
-	 */
-	
-	if(bytes_in_notebuffer < NOTE_BUFSIZE) {
-		/* We have room to add this byte */
-		note_buffer[bytes_in_notebuffer] = n;
-		time_buffer[bytes_in_notebuffer] = t;
-		bytes_in_notebuffer++;
-	} 
+void playback_stop(void) {
+
+	/* Discard an unfinished overdub */
+	if (play_dub != PLAY_DUB_OFF) {
+		if (play_dub == PLAY_DUB_RECORDING) {
+			recording = 0;
+			rec_length = dub_start;
+		}
+		play_dub = PLAY_DUB_OFF;
+	}
+
+	/* Turn off playback */
+	quiet();
+	note = 255;
+	tuneWait = 255;
+	octave = tmp_octave;
+	waveform = tmp_waveform;
+	wavetable_select(waveform);
 }
 
 
-void buffer_song(uint8_t* note_array, uint8_t* time_array) {
-	/* Procedure to output a song (by adding it to the outgoing buffer
-	 ** note by note). We iterate over all notes in the
-	 ** array. IMPORTANT: (Terminates with 111)
+void buffer_song(const uint8_t* song, uint16_t beat) {
+	/* Procedure to write a song (stored in flash) to the buffer
+	 ** note by note, each held for most of a beat. We iterate
+	 ** over all notes in the array. IMPORTANT: (Terminates with
+	 ** 111, 255 is a beat's rest)
 	 */
-	uint8_t i;
-	
+	uint8_t n;
+	uint16_t gap = 0;
+
+	notebuffer_clear();
+
 	/* Write to buffer */
-	for(i=0; note_array[i] != 111; i++) {
-		buffer_note(note_array[i], time_array[i]);
+	while ((n = pgm_read_byte(song++)) != 111) {
+		if (n == 255) {
+			gap += beat;
+		} else {
+			rec_append(REC_PRESS | n, gap);
+			rec_append(n, beat - REC_SONG_GAP);
+			gap = REC_SONG_GAP;
+		}
 	}
-	
+	rec_append(REC_END, gap);
+
 	/* Playback */
 	playBuffer();
-	
+
+}
+
+
+void notebuffer_clear(void) {
+	/* Empty the event buffer */
+	rec_length = 0;
+	rec_tracks = 0;
 }
 
 
 void record_start(void) {
 	/* Procedure to refresh the recorded data
-	 ** and activate recording of button presses
+	 ** and activate recording of button presses.
+	 ** Not while the buffer is being saved.
 	 */
+	if (store_busy) {
+		return;
+	}
 	notebuffer_clear();
 	rec_waveform = waveform;
-	rec_beatset = beatCount;
+	rec_beatset = tempo_nearest_tick();
 	rec_octave = octave;
+	rec_lasttime = sched_ms;
 	recording = 1;
 }
 
+/* Save the session to its slot, after any save being written,
+** reporting a save that can't start. An empty recording is not
+** saved.
+*/
+static void session_save(void) {
+
+	uint8_t result = store_save_queued(STORE_SESSION_SLOT);
+
+	if (result != STORE_EMPTY) {
+		store_print_result(result);
+	}
+}
+
 void record_stop(void) {
-	/* Switch off note recording*/
-	recording = 0;
-	//buffer_note(111,1);
+	/* Switch off note recording, and save the
+	** session so that it survives a reset
+	*/
+	if (recording && (play_dub == PLAY_DUB_RECORDING)) {
+		/* The overdub didn't fit; discard it */
+		recording = 0;
+		rec_length = dub_start;
+		play_dub = PLAY_DUB_OFF;
+	} else if (recording) {
+		recording = 0;
+		if (rec_length > 0) {
+			rec_append(REC_END, sched_ms - rec_lasttime);
+		}
+		tracks_scan();
+		session_save();
+	}
 }
 
-void record_note(uint8_t n, uint8_t t) {
-	/* Attempt to write the given values to the recording
-	** buffer. End recording if buffer full.
+void record_note(uint8_t n, uint8_t pressed, uint16_t t) {
+	/* Attempt to write the given event to the recording
+	** buffer. End recording if buffer full. An overdub is
+	** timed against the recording, so its deltas are scaled
+	** back from the playback tempo.
 	*/
-	buffer_note(n,t);
-	if (bytes_in_notebuffer == NOTE_BUFSIZE) {
+	uint32_t delta = t;
+
+	if (play_dub == PLAY_DUB_RECORDING) {
+		delta = delta * play_tempo / 100;
+		dub_length += delta;
+	}
+	if (!rec_append(pressed ? (REC_PRESS | n) : n, delta)) {
 		record_stop();
 	}
 }
@@ -116,74 +367,177 @@ void record_note(uint8_t n, uint8_t t) {
  ** 2beats/sec, so 500ms delay
  */
 void demoTuneStart(void) {
-	
-	if (recording==0) {
-		/* Note/time buffers */
-		const uint8_t twinkleSong[17] = {0,0,4,4,5,5,4,255,3,3,2,2,1,1,0,255,111};
-		const uint8_t twinkleTime[17] = {50};
-			//C:0 D:1 E:2 F:3 G:4 A:5 B:6 C:7 xx:255 EoF:111
-		
+
+	if ((recording==0) && (store_busy==0)) {
 		/* Settings */
 		rec_beatset = 0;
 		rec_waveform = waveform;
 		rec_octave = 0;
-	
+
 		/* Buffer write */
-		buffer_song(twinkleSong,twinkleTime);
+		buffer_song(twinkleSong, tempo_beat_ms());
 	}
 
 }
 
 
 
+uint8_t overdub_start(void) {
+	/* Arm an overdub of the next pass of a looping
+	** playback, if there is room for another track
+	*/
+	if ((tuneWait == 255) || !play_loop || recording ||
+			(play_dub != PLAY_DUB_OFF) || (rec_tracks >= REC_TRACKS)) {
+		return 0;
+	}
+	play_dub = PLAY_DUB_ARMED;
+	return 1;
+}
+
+
+/* At the end of a pass, start an armed overdub or append the
+** finished one as a new track, padded to the loop length
+*/
+static void overdub_pass(void) {
+
+	if (play_dub == PLAY_DUB_ARMED) {
+		dub_start = rec_length;
+		dub_length = 0;
+		rec_lasttime = sched_ms - (uint16_t)play_clock;
+		recording = 1;
+		play_dub = PLAY_DUB_RECORDING;
+
+	} else if (play_dub == PLAY_DUB_RECORDING) {
+		recording = 0;
+		play_dub = PLAY_DUB_OFF;
+		if ((rec_length == dub_start) ||
+				!rec_append(REC_END, (dub_length < base_length) ? base_length - dub_length : 0)) {
+			/* Nothing played, or no room to end it */
+			rec_length = dub_start;
+			return;
+		}
+		tracks_scan();
+		play_tracks = rec_tracks;
+		session_save();
+	}
+}
+
+
+/* Play a track's event */
+static void track_event(track_t* t) {
+
+	uint8_t n = t->event & ~REC_PRESS;
+	uint8_t held;
+
+	if (t->event & REC_PRESS) {
+		t->held |= (1<<n);
+		pressNote(n);
+	} else {
+		/* Another track may still hold the note */
+		t->held &= ~(1<<n);
+		held = tracks_held();
+		if (!(held & (1<<n))) {
+			releaseNote(n, held);
+		}
+	}
+}
+
+
+/* Play every event due, returning 0 when playback ends */
+static uint8_t play_tick(void) {
+
+	uint8_t i;
+	uint32_t now, pass_end = 0;
+	track_t* t;
+
+	play_clock += (uint16_t)(sched_ms - play_last);
+	play_last = sched_ms;
+	now = play_clock << 8;
+
+	for (;;) {
+		for (i=0; i<play_tracks; i++) {
+			t = &tracks[i];
+			while (now >= t->due) {
+				if (t->event == REC_END) {
+					if (i == 0) {
+						pass_end = t->due;
+					}
+					t->due = TRACK_DONE;
+					break;
+				}
+				track_event(t);
+				play_read(t);
+			}
+		}
+
+		/* The pass ends with the first track */
+		if (tracks[0].due != TRACK_DONE) {
+			return 1;
+		}
+		if (!play_loop || (pass_end < 256)) {
+			return 0;
+		}
+
+		/* Start the next pass, releasing any notes held
+		** when the recording stopped
+		*/
+		if (tracks_held()) {
+			quiet();
+			note = 255;
+		}
+		play_clock -= pass_end >> 8;
+		now = play_clock << 8;
+		overdub_pass();
+		pass_start(pass_end & 0xFF);
+	}
+}
+
+
+/* Beat clock subscriber: start playback on the tick of the
+** beat the recording started on
+*/
+void playback_tick(uint8_t tick) {
+	if ((tuneWait==1) && (tick==(rec_beatset % TEMPO_SUBDIV))) {
+		tuneWait = 0;
+		play_last = sched_ms;
+	}
+}
+
+
 /* Define the timer handler for playing notes from the buffer
 */
 void playbackStep(void) {
-	
-	/* 0. Check recording */
+
+	uint8_t n;
+	uint16_t start, cycles;
+	play_stat_t* s;
+
+	/* 0. Nothing to play while recording */
 	if ((recording==1) && (tuneWait==255)) {
-		rec_timecounter++;
 		return;
 	}
-	
-	/* 1. Time start of playback to beat LED */
-	if ((tuneWait==1) && (beatCount==rec_beatset)) {
-		tuneWait = 0;
-	}
-	
-	/* 2. Check if we have notes to play,
+
+	/* 1. Check if we have notes to play,
 	** and aren't still waiting for the beat
 	*/
-	if ((bytes_in_notebuffer > 0) && (tuneWait==0)) {
-		
-		/* Check note timing match */
-		if (playback_counter++ == playback_noteSpace) {
-
-			uint8_t n, t;
-		
-			/* Read from buffers */
-			n = note_buffer[bytes_in_notebuffer -1];
-			t = time_buffer[bytes_in_notebuffer -1];
-			bytes_in_notebuffer--;
-			
-			/* Play the note */
-			note = n;
-			pressNote();
-
-			if (bytes_in_notebuffer > 0) {
-				/* Prepare for the next note */
-				playback_noteSpace = t*10;
-				playback_counter = 0;
-			} else {
-				/* Turn off playback */
-				tuneWait = 255;
-				octave = tmp_octave;
-				waveform = tmp_waveform;
-			}
+	if (tuneWait!=0) {
+		return;
+	}
 
-		}
+	/* 2. Play them, timing the tick by track count */
+	n = play_tracks;
+	start = cycles_now();
+	if (!play_tick()) {
+		playback_stop();
+		return;
+	}
+	cycles = cycles_now() - start;
 
+	s = &play_stats[n];
+	s->ticks++;
+	s->total += cycles;
+	if (cycles > s->max) {
+		s->max = cycles;
 	}
-		
-}
 
+}
@@ -8,36 +8,93 @@
 #ifndef PLAYBACK_H
 #define PLAYBACK_H
 
-/* Global variables for the buffers */
-volatile uint8_t note_buffer[24];
-volatile uint8_t bytes_in_notebuffer;
-volatile uint8_t time_buffer[24];
-//value of 1 = a 10ms step
+/* Recording buffer size in bytes; an event takes 2-4 bytes */
+#define REC_BUFSIZE 512
+
+/* Most tracks in a recording (see playback.c) */
+#define REC_TRACKS 4
+
+/* Event byte: note number, with REC_PRESS set for a press */
+#define REC_PRESS 0x80
+
+/* Event byte marking the end of a recording, so that a loop
+** is as long as the recording was
+*/
+#define REC_END 0x7F
+
+/* Playback tempo in percent of the recorded speed */
+#define REC_TEMPO_MIN 25
+#define REC_TEMPO_MAX 400
+#define REC_TEMPO_STEP(percent) ((25600U + (percent)/2) / (percent))
+
+/* Silence between the notes of a buffered song, in ms */
+#define REC_SONG_GAP 50
+
+/* Overdub state */
+#define PLAY_DUB_OFF 0
+#define PLAY_DUB_ARMED 1		//starts with the next pass
+#define PLAY_DUB_RECORDING 2
+
+/* Cycles per playback tick */
+typedef struct {
+	uint32_t ticks;
+	uint32_t total;
+	uint16_t max;
+} play_stat_t;
+
+/* Global variables for the buffer */
+extern uint8_t rec_buffer[REC_BUFSIZE];
+	//the recorded events (store.c saves and loads it)
+extern volatile uint16_t rec_length;
+	//bytes recorded, 0 if nothing to play
+extern volatile uint8_t rec_tracks;
+	//tracks in the recording, once played
 
 /* Global variables for playback */
-volatile uint8_t playback_counter;
-volatile uint8_t playback_noteSpace;
-volatile uint8_t tuneWait;
+extern volatile uint8_t tuneWait;
+extern volatile uint8_t play_loop;
+	//restart at the end instead of stopping
+extern volatile uint16_t play_tempo;
+	//percent, see playback_set_tempo
+extern volatile uint8_t play_dub;
+extern play_stat_t play_stats[REC_TRACKS+1];
+	//by number of tracks playing
 
 /* Global variables for note recording */
-volatile uint8_t rec_waveform;
-volatile uint16_t rec_timecounter;
-volatile uint16_t rec_beatset;
-volatile uint8_t recording;
-volatile uint8_t rec_octave;
-volatile uint8_t tmp_octave;
+extern volatile uint8_t rec_waveform;
+extern volatile uint16_t rec_lasttime;
+	//sched_ms of the last recorded note
+extern volatile uint16_t rec_beatset;
+	//tick of the beat the recording started on (tempo.h)
+extern volatile uint8_t recording;
+extern volatile uint8_t rec_octave;
+extern volatile uint8_t tmp_octave;
 
 /* Public functions */
 void playBuffer(void);
 	//enable recording playback
+void playback_stop(void);
+	//stop playback and restore the settings
+void playback_set_tempo(uint16_t percent);
+	//play at percent of the recorded speed
+void tracks_scan(void);
+	//count the tracks, after the buffer is written
+uint8_t overdub_start(void);
+	//record a new track over the next pass of a loop
 void record_start(void);
 	//clear buffers, enable note storage
-void record_note(uint8_t n, uint8_t t);
-	//conditionally write note to buffer
+void record_note(uint8_t n, uint8_t pressed, uint16_t t);
+	//conditionally write a press/release t ms after the last
+void notebuffer_clear(void);
+	//discard the recording
+void buffer_song(const uint8_t* song, uint16_t beat);
+	//write a song from flash to the buffer and play it
 void record_stop(void);
 	//disable note storage
 void demoTuneStart(void);
 	//write demo tune to buffers
+void playback_tick(uint8_t tick);
+	//beat clock subscriber, starts playback in time
 void playbackStep(void);
 	//timer interrupt handler for playback
 
@@ -0,0 +1,90 @@
+/* power.c
+**
+** Idle sleep and its accounting (see power.h).
+*/
+
+#include "hal.h"
+#include "sched.h"
+#include "serial.h"
+#include "audio.h"
+#include "power.h"
+
+volatile uint8_t power_asleep = 0;
+volatile uint16_t power_woke;
+
+/* Counts since the last report. Whole ms of sleep are moved
+** out of sleepCycles after each sleep, and the window is
+** brought up to date by power_tick, so none of them wrap.
+*/
+static uint16_t sleepCycles = 0;
+static uint32_t sleepMs = 0;
+static uint32_t wakes = 0;
+static uint32_t statsMs = 0;
+static uint16_t lastMs = 0;
+	//sched_ms when statsMs was last brought up to date
+
+#define CYCLES_PER_MS (F_CPU/1000)
+
+
+void setup_power(void) {
+	hal_power_setup();
+}
+
+
+void power_sleep(void) {
+	
+	uint16_t start = hal_cycles();
+	
+	power_asleep = 1;
+	hal_sleep();
+	
+	/* A sleep ends within the 1ms tick, well inside the
+	** counter's 65536 cycle range
+	*/
+	if (!power_asleep) {
+		sleepCycles += (uint16_t)(power_woke - start);
+		if (sleepCycles >= CYCLES_PER_MS) {
+			sleepCycles -= CYCLES_PER_MS;
+			sleepMs++;
+		}
+		wakes++;
+	}
+	power_asleep = 0;
+}
+
+
+void power_tick(void) {
+	
+	uint16_t now = sched_ms;
+	
+	statsMs += (uint16_t)(now - lastMs);
+	lastMs = now;
+}
+
+
+void power_report(void) {
+	
+	uint32_t permille;
+	
+	power_tick();
+	output_string_P(PSTR("\r\n-Asleep:"));
+	if (statsMs) {
+		/* Per mille of the time since the last report */
+		permille = ((uint64_t)sleepMs * 1000 + sleepCycles / (CYCLES_PER_MS/1000)) / statsMs;
+		output_number(permille / 10);
+		output_char('.');
+		output_number(permille % 10);
+		output_string_P(PSTR("% Wakes:"));
+		output_number((uint64_t)wakes * 1000 / statsMs);
+		output_string_P(PSTR("/s"));
+	}
+	if (audio_gated) {
+		output_string_P(PSTR(" AudioOff"));
+	}
+	output_string_P(PSTR("- "));
+	
+	sleepCycles = 0;
+	sleepMs = 0;
+	wakes = 0;
+	statsMs = 0;
+}
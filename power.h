@@ -0,0 +1,55 @@
+/* power.h
+**
+** Idle sleep. Once a pass of the main loop finds nothing left
+** to do it sleeps in idle mode until the next interrupt, which
+** leaves the timers, UART, SPI and EEPROM running to wake it.
+** While no voice is sounding the audio path also switches off
+** timer 1 and the SPI (audio.h), so the 1ms tick, serial input
+** and EEPROM writes are then the only wakeups.
+**
+** Time asleep is counted from the sleep to the first handler
+** that runs, stamped by POWER_WAKE at the top of every
+** handler, so the handlers themselves count as awake. The serial 'power' command prints
+** the share of time asleep and the wakeups per second since it
+** was last used.
+*/
+
+#ifndef POWER_H
+#define POWER_H
+
+/* Set while sleeping, and the cycle count when the waking
+** handler was entered
+*/
+extern volatile uint8_t power_asleep;
+extern volatile uint16_t power_woke;
+
+/* Stamp the end of a sleep - called on handler entry */
+#define POWER_WAKE() do { \
+	if (power_asleep) { \
+		power_woke = hal_cycles(); \
+		power_asleep = 0; \
+	} \
+} while (0)
+
+/* Switch off unused peripherals and select idle sleep */
+void setup_power(void);
+
+/* Sleep until an interrupt, counting the time. Call with
+** interrupts disabled, once nothing is pending; returns with
+** them enabled.
+*/
+void power_sleep(void);
+
+/* Bring the report window up to date. Run by the scheduler
+** every POWER_TICK_MS, so that the 16-bit ms clock can't wrap
+** between updates.
+*/
+#define POWER_TICK_MS 1000
+void power_tick(void);
+
+/* Print the time asleep and wakeups over serial, and clear
+** them
+*/
+void power_report(void);
+
+#endif
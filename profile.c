@@ -0,0 +1,81 @@
+/* profile.c
+**
+** Interrupt handler profiling stats (see profile.h).
+*/
+
+#include "hal.h"
+#include "serial.h"
+#include "profile.h"
+
+#ifdef PROFILE_ISR
+
+prof_stat_t prof_stats[PROF_COUNT] = {
+	{0, 0, 0xFFFF, 0}, {0, 0, 0xFFFF, 0}, {0, 0, 0xFFFF, 0},
+	{0, 0, 0xFFFF, 0}, {0, 0, 0xFFFF, 0}
+};
+
+static const char profT1Name[] PROGMEM = "T1";
+static const char profT2Name[] PROGMEM = "T2";
+static const char profRxName[] PROGMEM = "RX";
+static const char profUdreName[] PROGMEM = "UDRE";
+static const char profEeName[] PROGMEM = "EE";
+
+static PGM_P const profNames[PROF_COUNT] PROGMEM = {
+	profT1Name, profT2Name, profRxName, profUdreName, profEeName
+};
+
+
+void profile_dump(void) {
+	
+	prof_stat_t s;
+	uint8_t i;
+	
+	output_string_P(PSTR("\r\nISR n min avg max"));
+	for (i=0; i<PROF_COUNT; i++) {
+		
+		/* Take a consistent copy */
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			s = prof_stats[i];
+		}
+		output_string_P(PSTR("\r\n"));
+		output_string_P((PGM_P)pgm_read_ptr(&profNames[i]));
+		output_string_P(PSTR(" "));
+		output_number(s.calls);
+		if (s.calls == 0) {
+			continue;
+		}
+		output_string_P(PSTR(" "));
+		output_number(s.min);
+		output_string_P(PSTR(" "));
+		output_number(s.total / s.calls);
+		output_string_P(PSTR(" "));
+		output_number(s.max);
+	}
+	output_string_P(PSTR(" "));
+}
+
+
+void profile_reset(void) {
+	
+	uint8_t i;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		for (i=0; i<PROF_COUNT; i++) {
+			prof_stats[i].calls = 0;
+			prof_stats[i].total = 0;
+			prof_stats[i].min = 0xFFFF;
+			prof_stats[i].max = 0;
+		}
+	}
+}
+
+#else
+
+void profile_dump(void) {
+	output_string_P(PSTR("\r\n-NoProfiling- "));
+}
+
+void profile_reset(void) {
+}
+
+#endif
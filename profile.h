@@ -0,0 +1,62 @@
+/* profile.h
+**
+** Optional interrupt handler profiling. When built with
+** PROFILE_ISR defined, every handler brackets its body with
+** PROF_ENTER/PROF_EXIT, which time it on the free-running cycle
+** counter (timer 3) and keep a call count and min/max/total
+** cycles per handler. The serial 'Q' command prints the stats
+** and 'Z' clears them.
+**
+** Without PROFILE_ISR the macros expand to nothing and no stats
+** are kept, so release builds pay nothing. Timings cover the
+** handler body only, not the compiler's register save/restore.
+*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/* Profiled handlers */
+#define PROF_TIMER1 0
+#define PROF_TIMER2 1
+#define PROF_UART_RX 2
+#define PROF_UART_UDRE 3
+#define PROF_EEPROM 4
+#define PROF_COUNT 5
+
+#ifdef PROFILE_ISR
+
+typedef struct {
+	uint32_t calls;
+	uint32_t total;
+	uint16_t min;
+	uint16_t max;
+} prof_stat_t;
+
+extern prof_stat_t prof_stats[PROF_COUNT];
+
+/* Only called from interrupt handlers, which don't nest */
+static inline void prof_record(uint8_t id, uint16_t cycles) {
+	prof_stat_t* s = &prof_stats[id];
+	s->calls++;
+	s->total += cycles;
+	if (cycles < s->min) s->min = cycles;
+	if (cycles > s->max) s->max = cycles;
+}
+
+#define PROF_ENTER(id) uint16_t prof_start = hal_cycles()
+#define PROF_EXIT(id) prof_record((id), hal_cycles() - prof_start)
+
+#else
+
+#define PROF_ENTER(id)
+#define PROF_EXIT(id)
+
+#endif
+
+/* Print the stats over serial */
+void profile_dump(void);
+
+/* Clear the stats */
+void profile_reset(void);
+
+#endif
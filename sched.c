@@ -0,0 +1,109 @@
+/* sched.c
+**
+** Cooperative tick scheduler (see sched.h).
+*/
+
+#include "hal.h"
+#include "serial.h"
+#include "sched.h"
+
+/* Tasks are kept sorted by descending priority, so the first
+** ready task found is the one to run.
+*/
+static task_t tasks[SCHED_MAX_TASKS];
+static uint8_t num_tasks = 0;
+
+volatile uint16_t sched_ms = 0;
+
+
+uint8_t sched_add(task_fn fn, PGM_P name, uint16_t period, uint8_t priority) {
+	
+	uint8_t i;
+	
+	if (num_tasks == SCHED_MAX_TASKS) {
+		return 255;
+	}
+	
+	/* Insert after every task of the same or higher priority */
+	for (i=num_tasks; (i>0) && (tasks[i-1].priority < priority); i--) {
+		tasks[i] = tasks[i-1];
+	}
+	tasks[i].fn = fn;
+	tasks[i].name = name;
+	tasks[i].period = period;
+	tasks[i].countdown = period;
+	tasks[i].priority = priority;
+	tasks[i].ready = 0;
+	tasks[i].overruns = 0;
+	num_tasks++;
+	return i;
+}
+
+
+void sched_tick(void) {
+	
+	uint8_t i;
+	task_t* t = tasks;
+	
+	sched_ms++;
+	
+	for (i=0; i<num_tasks; i++, t++) {
+		if (--t->countdown == 0) {
+			t->countdown = t->period;
+			if (t->ready) {
+				/* Still waiting from its last period */
+				t->overruns++;
+			}
+			t->ready = 1;
+		}
+	}
+}
+
+
+uint8_t sched_run(void) {
+	
+	uint8_t i;
+	task_t* t = tasks;
+	
+	for (i=0; i<num_tasks; i++, t++) {
+		if (t->ready) {
+			t->ready = 0;
+			t->fn();
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+uint8_t sched_pending(void) {
+	
+	uint8_t i;
+	
+	for (i=0; i<num_tasks; i++) {
+		if (tasks[i].ready) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+void sched_report(void) {
+	
+	uint8_t i;
+	uint16_t overruns;
+	
+	output_string_P(PSTR("\r\nOverruns:"));
+	for (i=0; i<num_tasks; i++) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			overruns = tasks[i].overruns;
+			tasks[i].overruns = 0;
+		}
+		output_string_P(PSTR(" "));
+		output_string_P(tasks[i].name);
+		output_string_P(PSTR("="));
+		output_number(overruns);
+	}
+	output_string_P(PSTR(" "));
+}
@@ -0,0 +1,51 @@
+/* sched.h
+**
+** Cooperative tick scheduler. Tasks register with a period in
+** milliseconds and a priority. The 1ms timer 2 interrupt only
+** calls sched_tick(), which advances the clock and marks tasks
+** ready; the main loop calls sched_run(), which runs the
+** highest-priority ready task. A task that falls due again
+** before it has run counts an overrun.
+*/
+
+#ifndef SCHED_H
+#define SCHED_H
+
+/* Room for the tasks app_setup registers, and a few more */
+#define SCHED_MAX_TASKS 12
+
+typedef void (*task_fn)(void);
+
+typedef struct {
+	task_fn fn;
+	PGM_P name;
+	uint16_t period;	//ms
+	uint16_t countdown;	//ms until next due
+	uint8_t priority;	//higher runs first
+	volatile uint8_t ready;
+	volatile uint16_t overruns;
+} task_t;
+
+/* Milliseconds since startup (wraps) */
+extern volatile uint16_t sched_ms;
+
+/* Register a task before interrupts are enabled. Returns its
+** index, or 255 if the table is full.
+*/
+uint8_t sched_add(task_fn fn, PGM_P name, uint16_t period, uint8_t priority);
+
+/* Advance time by 1ms - called from the timer 2 interrupt */
+void sched_tick(void);
+
+/* Run the highest-priority ready task, if any. Returns 1 if a
+** task ran. Called from the main loop.
+*/
+uint8_t sched_run(void);
+
+/* Nonzero if any task is ready */
+uint8_t sched_pending(void);
+
+/* Print each task's overrun count over serial, and clear them */
+void sched_report(void);
+
+#endif
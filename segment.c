@@ -1,54 +1,180 @@
 /* segment.c
 **
 ** Handles operations for the 7-segment display.
-** Matches note index to a segment value, and
+** Shows the current note and octave, or a line of text
+** scrolled across the two digits, and
 ** Outputs to a PMOD on PORTC (Connector JB)
 */
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
+#include "hal.h"
+#include "notes.h"
+#include "segment.h"
+
+/* Segment patterns (bit 0 = a ... bit 6 = g) of the digits
+** and letters, kept in flash. Some letters can only be
+** approximated.
+*/
+static const uint8_t digitSegments[10] PROGMEM = {
+	0x3F,0x06,0x5B,0x4F,0x66,0x6D,0x7D,0x07,0x7F,0x6F
+};
+static const uint8_t letterSegments[26] PROGMEM = {
+	0x77,0x7C,0x39,0x5E,0x79,0x71,0x3D,0x76,0x30,0x1E,0x75,0x38,0x37,
+	0x54,0x5C,0x73,0x67,0x50,0x6D,0x78,0x3E,0x1C,0x2A,0x76,0x6E,0x5B
+};
+	//0-9, A-Z: 0123456789 AbCdEFGHIJKLMnoPqrStUvWXyZ
+
+/* Letters of the notes of the buttons */
+static const char noteNames[8] PROGMEM = "CDEFGABC";
+
+uint8_t segment_brightness = SEGMENT_LEVELS;
+
+/* Port values for each refresh slot, and the next slot */
+static uint8_t frame[SEGMENT_FRAMES];
+static uint8_t framePos = 0;
+
+/* The note and octave in the framebuffer; 254 forces a rebuild */
+static uint8_t shownNote = 254;
+static uint8_t shownOctave = 0;
+
+/* Segment patterns of the text being scrolled, its length
+** and the position of the left digit in it
+*/
+static uint8_t text[SEGMENT_TEXT_SIZE];
+static uint8_t textLength = 0;
+static uint8_t textPos = 0;
 
 
 void setup_segmentDisplay(void) {
-	
+
 	/* Setup the data direction register for PORTC (7SEG) */
-	DDRC = 0xFF;
+	hal_segment_setup();
+}
+
+/* Segment pattern of a character */
+static uint8_t char_segments(char c) {
+
+	if ((c>='0') && (c<='9')) {
+		return pgm_read_byte(&digitSegments[c-'0']);
+	}
+	if ((c>='a') && (c<='z')) {
+		c -= 'a'-'A';
+	}
+	if ((c>='A') && (c<='Z')) {
+		return pgm_read_byte(&letterSegments[c-'A']);
+	}
+	if (c=='-') {
+		return 0x40;
+	}
+	return 0;
+}
+
+/* Fill the framebuffer with the given digits. A digit is lit
+** in the pairs of slots where the running total of the level
+** steps over a whole number. Blank slots write 0, as a blank
+** digit always has.
+*/
+static void frame_build(uint8_t left, uint8_t right) {
+
+	uint8_t i, lit;
+
+	for (i=0; i<SEGMENT_LEVELS; i++) {
+		lit = ((i+1)*segment_brightness)/SEGMENT_LEVELS != (i*segment_brightness)/SEGMENT_LEVELS;
+		frame[2*i] = (lit && left) ? (left | SEGMENT_CAT) : 0;
+		frame[2*i+1] = lit ? right : 0;
+	}
 }
 
-uint8_t noteToSegVal(uint8_t noteIndex, uint8_t isLeftChar, uint8_t isUpOctave) {
-	
-	/* Stored, precalculated values to write
-	** to the port for each number/letter
-	*/
-	const uint8_t segments[11] = {0xB9,0xDE,0xF9,0xF1,0xBD,0xF7,0xFC,0xB9,0x66,0x6D,0x7D};
-	//values: CDEFGABC456 = 0x{B9,DE,F9,F1,BD,F7,FC,B9,66,6D,7D}
-	
+/* Show the current note: its letter on the left, its octave on
+** the right (4 or 5, one higher in the upper octave)
+*/
+static void frame_note(void) {
+
+	shownNote = note;
+	shownOctave = octave;
+
 	/* Blank for no note */
-	if (noteIndex==255) {
-		return 0;
+	if ((note==255) || (note>7)) {
+		frame_build(0, 0);
+		return;
 	}
-	
-	/* CAT=1, left side - alphabetic */
-	if (isLeftChar) {
-		if (noteIndex<=7) {
-			return segments[noteIndex];
-		}
+	frame_build(char_segments(pgm_read_byte(&noteNames[note])),
+		char_segments('4' + octave + (note==7)));
+}
+
+/* Show the text at textPos, blank beyond its ends */
+static void frame_text(void) {
+
+	frame_build((textPos>0) ? text[textPos-1] : 0,
+		(textPos<textLength) ? text[textPos] : 0);
+}
+
+
+void segmentRefresh(void) {
+
+	/* The note is only looked up when it has changed */
+	if ((textLength==0) && ((note!=shownNote) || (octave!=shownOctave))) {
+		frame_note();
+	}
+	hal_segment_write(frame[framePos]);
+	framePos = (framePos+1) & (SEGMENT_FRAMES-1);
+}
+
+void segment_scroll_step(void) {
+
+	if (textLength==0) {
+		return;
 	}
-	/* CAT=0, right side - numeric */
-	else {
-		if (noteIndex<7)//octave 4
-			return segments[8+isUpOctave];
-		if (noteIndex==7)//octave 5
-			return segments[9+isUpOctave];
+	/* The text enters on the right and leaves on the left */
+	if (++textPos > textLength) {
+		textLength = 0;
+		frame_note();
+		return;
+	}
+	frame_text();
+}
 
+/* Start scrolling the text just stored */
+static void scroll_start(void) {
+
+	textPos = 0;
+	if (textLength) {
+		frame_text();
+	} else {
+		frame_note();
 	}
-	/* Backup return value: no display */
-	return 0;
-	
 }
 
-void segmentPrint(uint8_t noteIndex, uint8_t isLeftChar, uint8_t isUpOctave) {
-	
-	/* Print to the port */
-	PORTC = noteToSegVal(noteIndex, isLeftChar, isUpOctave);
-}
\ No newline at end of file
+void segment_scroll(const char* s) {
+
+	textLength = 0;
+	while (*s && (textLength<SEGMENT_TEXT_SIZE)) {
+		text[textLength++] = char_segments(*s++);
+	}
+	scroll_start();
+}
+
+void segment_scroll_P(PGM_P s) {
+
+	char c;
+
+	textLength = 0;
+	while ((c = pgm_read_byte(s++)) && (textLength<SEGMENT_TEXT_SIZE)) {
+		text[textLength++] = char_segments(c);
+	}
+	scroll_start();
+}
+
+void segment_set_brightness(uint8_t level) {
+
+	if (level>SEGMENT_LEVELS) {
+		level = SEGMENT_LEVELS;
+	}
+	segment_brightness = level;
+
+	/* Rebuild whatever is shown */
+	if (textLength) {
+		frame_text();
+	} else {
+		frame_note();
+	}
+}
@@ -1,21 +1,66 @@
 /* segment.h
  **
  ** Handles operations for the 7-segment display.
- ** Matches note index to a segment value, and
+ ** Shows the current note and octave, or a line of text
+ ** scrolled across the two digits, and
  ** Outputs to a PMOD on PORTC (Connector JB)
+ **
+ ** The display is driven from a framebuffer of port values,
+ ** one per refresh slot, built only when what is shown
+ ** changes (a new note or octave, a scroll step or a new
+ ** brightness). Each refresh just writes the next byte.
  */
 
 #ifndef SEGMENT_H
 #define SEGMENT_H
 
+/* Each refresh slot lights one digit for this long */
+#define SEGMENT_REFRESH_MS 1
+
+/* Brightness levels. A digit at level n is lit in n of every
+** SEGMENT_LEVELS of its slots, spread out, and blank in the
+** rest; 0 turns the display off.
+*/
+#define SEGMENT_LEVELS 4
+
+/* Refresh slots in the framebuffer: both digits at every level
+** (a power of two)
+*/
+#define SEGMENT_FRAMES (2*SEGMENT_LEVELS)
+
+/* Scrolled text moves one character this often */
+#define SEGMENT_SCROLL_MS 250
+
+/* Longest text that can be scrolled */
+#define SEGMENT_TEXT_SIZE 16
+
+/* Port bit selecting the left digit (CAT) */
+#define SEGMENT_CAT 0x80
+
 
 /* Configure the 7SEG port for In/Out */
 void setup_segmentDisplay(void);
 
-/* Matching the note index to 7-segment display port values */
-uint8_t noteToSegVal(uint8_t noteIndex, uint8_t isLeftChar, uint8_t isUpOctave);
+/* Multiplexing task: write the next framebuffer slot to the
+** port (run every SEGMENT_REFRESH_MS by the scheduler)
+*/
+void segmentRefresh(void);
+
+/* Scroll task: move any text along one character (run every
+** SEGMENT_SCROLL_MS by the scheduler)
+*/
+void segment_scroll_step(void);
+
+/* Scroll a line of text across the display once, in place of
+** the note, from RAM or flash. Letters are shown as well as
+** seven segments allow; characters with no segment pattern
+** are blank.
+*/
+void segment_scroll(const char* text);
+void segment_scroll_P(PGM_P text);
 
-/* Printing to the display */
-void segmentPrint(uint8_t noteIndex, uint8_t isLeftChar, uint8_t isUpOctave);
+/* Set the brightness, 0 to SEGMENT_LEVELS */
+void segment_set_brightness(uint8_t level);
+extern uint8_t segment_brightness;
 
 #endif
@@ -1,7 +1,8 @@
 /* serial2.h
 **
 ** Functions to handle serial port communications:
-** setup, send, receive, parse.
+** setup, send and receive. Received characters
+** are parsed by the command interpreter (cmd.h).
 ** It is assumed that the RS232 PMOD is connected to
 ** Connector JC top, i.e. PORTE 0..3
 **
@@ -9,50 +10,73 @@
 ** can take place.
 */
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
+#include "hal.h"
+#include "serial.h"
 #include "notes.h"
-#include "led.h"
-#include "playback.h"
+#include "tempo.h"
+#include "profile.h"
+#include "power.h"
+#include "stream.h"
+#include "midi.h"
 
 /* Global variables */
 /* 
- ** Circular buffer to hold outgoing characters. The insert_pos variable
- ** keeps track of the position (0 to BUFFER_SIZE-1) that the next
- ** outgoing character should be written to. bytes_in_buffer keeps
- ** count of the number of characters currently stored in the buffer 
- ** (ranging from 0 to BUFFER_SIZE). This number of bytes immediately
- ** prior to the current insert_pos are the bytes waiting to be output.
- ** If the insert_pos reaches the end of the buffer it will wrap around
- ** to the beginning (assuming those bytes have been output).
+ ** Ring buffer to hold outgoing characters. tx_head is the position
+ ** the next outgoing character will be written to and tx_tail the
+ ** next one to be sent; both are masked with SERIAL_TX_MASK. The
+ ** buffer is empty when they are equal and full when advancing
+ ** tx_head would make them equal, so one slot is always unused.
+ ** Only writers advance tx_head and only the UDRE handler advances
+ ** tx_tail.
  */
-#define BUFFER_SIZE 64
-volatile char buffer[64];
-volatile unsigned char insert_pos = 0;
-volatile unsigned char bytes_in_buffer = 0;
+static volatile char tx_buffer[SERIAL_TX_SIZE];
+static volatile uint8_t tx_head = 0;
+static volatile uint8_t tx_tail = 0;
+volatile uint16_t serial_tx_dropped = 0;
+
+/* Ring buffer of received characters, filled by the receive
+** handler and emptied by serial_getc(), same convention as above.
+*/
+static volatile char rx_buffer[SERIAL_RX_SIZE];
+static volatile uint8_t rx_head = 0;
+static volatile uint8_t rx_tail = 0;
+volatile uint16_t serial_rx_dropped = 0;
+volatile uint16_t serial_rx_overruns = 0;
 volatile unsigned char noteLines = 0;
 
+/* Note letters for output_note */
+static const char noteLetters[8] PROGMEM = {'C','D','E','F','G','A','B','C'};
+
+
 void setup_serial(void) {
-	/* Set the baud rate to 9600 */
-	UBRR0H = 0;
-	UBRR0L = 51;
-	/* This value is from table 84 (page 196) of the datasheet */
-	/* NOTE - this is one example of a value split across
-	** more than one 8-bit I/O register - however you can NOT
-	** just say UBRR0 = 25; - you MUST address each half
-	** separately. This is because UBRR0H and UBRR0L are not
-	** next to each other in I/O register space.
-	*/
-	
 	/*
-	 ** Enable transmission and receiving via UART and also 
-	 ** enable the Receive Complete Interrupt and the Data Register
-	 ** Empty interrupt. This ensures that we get an interrupt
-	 ** when the UART receives a character and when it is ready
-	 ** to accept a new character for transmission.
+	 ** Set the baud rate, and enable transmission and receiving via
+	 ** UART and also enable the Receive Complete Interrupt and the
+	 ** Data Register Empty interrupt. This ensures that we get an
+	 ** interrupt when the UART receives a character and when it is
+	 ** ready to accept a new character for transmission.
 	 ** (See page 190 of the datasheet)
 	 */
-	UCSR0B = (1<<RXCIE0) | (1<<UDRIE0) | (1<<RXEN0) | (1<<TXEN0);
+	serial_set_baud(SERIAL_BAUD);
+	
+	/* Optionally start up as a MIDI instrument */
+#ifdef SERIAL_MIDI
+	midi_start();
+#endif
+}
+
+
+/* serial_set_baud
+ **
+ ** Reprogram the UART for the given baud rate, in double speed
+ ** (U2X) mode: UBRR = F_CPU/(8*baud) - 1, rounded to nearest.
+ ** Characters in flight may be corrupted.
+ */
+void serial_set_baud(uint32_t baud) {
+	
+	uint16_t ubrr = (F_CPU + 4*baud) / (8*baud) - 1;
+	
+	hal_uart_setup(ubrr, 1);
 }
 
 
@@ -60,102 +84,115 @@ void setup_serial(void) {
  **
  ** Procedure to output a character (by adding it to the outgoing buffer)
  ** (The characters will get consumed by an interrupt handler (see below).)
+ ** If the buffer is full the character is discarded and counted in
+ ** serial_tx_dropped. Interrupts are held off only while the
+ ** byte is pushed, a few cycles, so that strings don't delay
+ ** the sample and receive interrupts.
  */
+static void output_char_unlocked(char c) {
+	
+	uint8_t next = (tx_head + 1) & SERIAL_TX_MASK;
+	
+	if (next == tx_tail) {
+		/* we have no room to add the byte - discard it */
+		serial_tx_dropped++;
+		return;
+	}
+	tx_buffer[tx_head] = c;
+	tx_head = next;
+}
+
 void output_char(char c) {
-	/* Add the character to the buffer for transmission if there
-	 ** is space to do so. We advance the insert_pos to the next
-	 ** character position. If this is beyond the end of the buffer
-	 ** we wrap around back to the beginning of the buffer */
-	/* NOTE: this only gets executed within an interrupt handler
-	 ** so we can be guaranteed uninterrupted access to the buffer.
-	 */
-	if(bytes_in_buffer < BUFFER_SIZE) {
-		/* We have room to add this byte */
-		buffer[insert_pos++] = c;
-		bytes_in_buffer++;
-		if(insert_pos == BUFFER_SIZE) {
-			/* Wrap around buffer pointer if necessary */
-			insert_pos = 0;
-		}
-	} 
-	/* else, we have no room to add the byte - just discard it */
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		output_char_unlocked(c);
+	}
+	
+	/* Activate the output buffer check bit */
+	hal_uart_tx_irq_enable();
 }
 
 /* output_string
  **
  ** Procedure to output a string (by adding it to the outgoing buffer
  ** character by character). We iterate over all characters in the
- ** string. (Remember, strings are null-terminated.)
+ ** string. (Remember, strings are null-terminated.) All output
+ ** comes from the main loop, so strings are never interleaved.
  */
 void output_string(char* str) {
 	
-	/* Activate the output buffer check bit */
-	UCSR0B |= (1<<UDRIE0);
-	
 	unsigned char i;	/* index into the string */
+	
 	for(i=0; str[i] != 0; i++) {
 		output_char(str[i]);
 	}
 }
 
-
-/* noteStringTimeDetect
+/* output_string_P
  **
- ** Returns a lowercase/uppercase version of the note string
- ** depending on whether we are within 10% of the beat.
- ** As the LED is on for 100ms, this occurs from 0..100ms.
+ ** As output_string, but for a string stored in flash (PSTR()),
+ ** which is read byte by byte without a copy in SRAM.
  */
-void noteStringTimeDetect(char* str1, char* str2) {
+void output_string_P(PGM_P str) {
 	
-	/* Check LED state */
-	if ((beatCount>=450) || (beatCount<=50)) {
-		/* uppercase if LED on */
-		output_string(str1);
-		return;
+	char c;
+	
+	while ((c = pgm_read_byte(str++)) != 0) {
+		output_char(c);
 	}
-	output_string(str2);
+}
+
 
+/* output_number
+ **
+ ** Procedure to output an unsigned number in decimal, without
+ ** leading zeros.
+ */
+void output_number(uint32_t n) {
+	
+	char str[11];
+	unsigned char i = 10;
+	
+	str[i] = 0;
+	do {
+		str[--i] = '0' + (n % 10);
+		n /= 10;
+	} while (n > 0);
+	output_string(&str[i]);
 }
 
+
 /* output_note
  **
- ** Abstraction of output_string matching note index to string.
+ ** Output the current note as e.g. " C4" - uppercase if we are within
+ ** 10% of a beat of the beat clock (either side), lowercase
+ ** otherwise.
  ** Also accounts for scrolling every 20 lines.
  ** New note read from the "notes.c" global value
  */
 void output_note(void) {
 	
-	/* output a string matching the note */
+	char str[4];
 	
-	if (octave==0) switch (note) {
-		case 0: noteStringTimeDetect(" C4"," c4"); break;
-		case 1: noteStringTimeDetect(" D4"," d4"); break;
-		case 2: noteStringTimeDetect(" E4"," e4"); break;
-		case 3: noteStringTimeDetect(" F4"," f4"); break;
-		case 4: noteStringTimeDetect(" G4"," g4"); break;
-		case 5: noteStringTimeDetect(" A4"," a4"); break;
-		case 6: noteStringTimeDetect(" B4"," b4"); break;
-		case 7: noteStringTimeDetect(" C5"," c5"); break;
-		default: break;
-	} else
-	if (octave==1) switch (note) {
-		case 0: noteStringTimeDetect(" C5"," c5"); break;
-		case 1: noteStringTimeDetect(" D5"," d5"); break;
-		case 2: noteStringTimeDetect(" E5"," e5"); break;
-		case 3: noteStringTimeDetect(" F5"," f5"); break;
-		case 4: noteStringTimeDetect(" G5"," g5"); break;
-		case 5: noteStringTimeDetect(" A5"," a5"); break;
-		case 6: noteStringTimeDetect(" B5"," b5"); break;
-		case 7: noteStringTimeDetect(" C6"," c6"); break;
-		default: break;
+	if (note<=7) {
+		str[0] = ' ';
+		str[1] = pgm_read_byte(&noteLetters[note]);
+		str[2] = '4' + octave + (note==7);
+		str[3] = 0;
+		
+		/* Check the beat clock */
+		if (!tempo_on_beat()) {
+			/* lowercase if off the beat */
+			str[1] += 'a'-'A';
+		}
+		output_string(str);
 	}
-
 	
 	/* Increment note counter & check for newline */
 	noteLines++;
 	if (noteLines>=20) {
 		noteLines = 0;
-		output_string("\r\n");
+		output_string_P(PSTR("\r\n"));
 	}
 	
 }
@@ -166,35 +203,45 @@ void output_note(void) {
  */
 ISR(USART0_UDRE_vect)
 {
+	uint8_t tail = tx_tail;
+	
+	POWER_WAKE();
+	PROF_ENTER(PROF_UART_UDRE);
+	
 	/* Check if we have data in our buffer */
-	if(bytes_in_buffer > 0) {
-		/* Yes we do - remove the pending byte and output it
-		 ** via the UART. The pending byte (character) is the
-		 ** one which is "bytes_in_buffer" characters before the 
-		 ** insert_pos (taking into account that we may 
-		 ** need to wrap around to the end of the buffer).
-		 */
-		char c;
-		if(insert_pos - bytes_in_buffer < 0) {
-			/* Need to wrap around */
-			c = buffer[insert_pos - bytes_in_buffer
-					   + BUFFER_SIZE];
-		} else {
-			c = buffer[insert_pos - bytes_in_buffer];
-		}
-		/* Decrement our count of the number of bytes in the 
-		 ** buffer 
-		 */
-		bytes_in_buffer--;
-		
-		/* Output the character via the UART */
-		UDR0 = c;
+	if(tail != tx_head) {
+		/* Yes we do - output the oldest byte via the UART */
+		hal_uart_write(tx_buffer[tail]);
+		tx_tail = (tail + 1) & SERIAL_TX_MASK;
 	} else {
 		/* no data in buffer - deactivate the buffer read interrupt.
 		 */		
-		UCSR0B ^= (1<<UDRIE0);
+		hal_uart_tx_irq_disable();
 	}
 	
+	PROF_EXIT(PROF_UART_UDRE);
+}
+
+
+/* serial_getc
+ **
+ ** Take the oldest received character from the incoming buffer.
+ ** Returns 0 if there is none. Main loop only.
+ */
+uint8_t serial_getc(char* c) {
+	
+	uint8_t tail = rx_tail;
+	
+	if (tail == rx_head) {
+		return 0;
+	}
+	*c = rx_buffer[tail];
+	rx_tail = (tail + 1) & SERIAL_RX_MASK;
+	return 1;
+}
+
+uint8_t serial_rx_pending(void) {
+	return rx_tail != rx_head;
 }
 
 
@@ -205,75 +252,34 @@ ISR(USART0_UDRE_vect)
  /* This name comes from the AVR libC documentation - see avr/interrupt.h */
 ISR(USART0_RX_vect)
 {
-	/* A character has been received - we will read it. If
-	** it corresponds to a key command we will execute that action.
+	/* A character has been received - queue it for the command
+	** parser (cmd.h), which runs from the main loop. If the queue
+	** is full the character is discarded and counted. In streaming
+	** mode it is a sample for the jitter buffer (stream.h), and in
+	** MIDI mode it goes to the MIDI parser (midi.h) instead.
 	*/
-	char input;
-
-	/* Extract character from UART Data register and place in input
-	** variable
-	*/
-	input = UDR0;
-
-	/* Convert character to upper case if it is lower case */
-	if(input >= 'a' && input <= 'z') {
-		/* Subtract 32 to change lower case character ASCII code
-		** into upper case. */
-		input -= 32;	
-	}
-	
-	/* 'T' handler: toggle triangle waveform */
-	else if ((input == 'T') && (recording==0)) {
-		set_waveform(1);
-	}
-	
-	/* 'S' handler: toggle sine waveform */
-	else if ((input == 'S') && (recording==0)) {
-		set_waveform(2);
-	}	
-	
-	/* 'D' handler: demo tune */
-	else if ((input == 'D') && (tuneWait==0)) {
-		demoTuneStart();
-		output_string("\r\n-DemoTune- ");
-	}
-	
-	/* '<' handler: dec triangular waveform */
-	else if ((input == '<') && (triWaveSteps>4)) {
-		triWaveSteps--;
-				//output_string(" Triangle_Wave_Steps_dec");
-	}
+	uint8_t head = rx_head;
+	uint8_t next = (head + 1) & SERIAL_RX_MASK;
 	
-	/* '>' handler: inc triangular waveform */
-	else if ((input == '>') && (triWaveSteps<16)) {
-		triWaveSteps++;
-				//output_string(" Triangle_Wave_Steps_inc");
-	}
+	POWER_WAKE();
+	PROF_ENTER(PROF_UART_RX);
 	
-	/* 'U' handler: toggle double wavelength */
-	else if ((input=='U') && (recording==0)) {
-		octave ^= 1;
-		output_string("\r\n-OctaveToggle- ");
-	}
-	
-	/* 'R' handler: toggle recording if available */
-	else if ((input=='R') && (tuneWait==255)) {
-		if (recording) {
-			record_stop();
-			output_string(" -RecordingStop-");
-		} else {
-			record_start();
-			output_string(" -RecordingStart-");
-		}
+	/* Count characters lost because this handler was late */
+	if (hal_uart_overrun()) {
+		serial_rx_overruns++;
 	}
 	
-	/* 'P' handler: play recording if available */
-	else if ((input=='P')) {
-		if ((recording==0) && (tuneWait==255) && (bytes_in_notebuffer>0)) {
-			playBuffer();
-			output_string(" -playbackStart-");
-		}
-		
+	if (stream_active) {
+		stream_rx(hal_uart_read());
+	} else if (midi_active) {
+		midi_rx(hal_uart_read());
+	} else if (next == rx_tail) {
+		(void)hal_uart_read();
+		serial_rx_dropped++;
+	} else {
+		rx_buffer[head] = hal_uart_read();
+		rx_head = next;
 	}
 	
-}
\ No newline at end of file
+	PROF_EXIT(PROF_UART_RX);
+}
@@ -1,7 +1,8 @@
 /* serial2.h
 **
 ** Functions to handle serial port communications:
-** setup, send, receive, parse.
+** setup, send and receive. Received characters
+** are parsed by the command interpreter (cmd.h).
 ** It is assumed that the RS232 PMOD is connected to
 ** Connector JC top, i.e. PORTE 0..3
 **
@@ -12,18 +13,60 @@
 #ifndef SERIAL_H
 #define SERIAL_H
 
-#define BUFFER_SIZE 64
-volatile char buffer[BUFFER_SIZE];
-volatile unsigned char insert_pos;
-volatile unsigned char bytes_in_buffer;
-volatile unsigned char noteLines;
+#include "hal.h"
+
+/* Default baud rate, override with -DSERIAL_BAUD=... The UART runs
+** in double speed mode, so at 8MHz 250000, 500000 and 1000000 baud
+** are exact; 9600 is 0.2% off and 115200 is 3.5% off.
+*/
+#ifndef SERIAL_BAUD
+#define SERIAL_BAUD 9600UL
+#endif
+
+#define SERIAL_UBRR ((F_CPU + 4*(SERIAL_BAUD)) / (8*(SERIAL_BAUD)) - 1)
+#define SERIAL_BAUD_ACTUAL (F_CPU / (8*(SERIAL_UBRR + 1)))
+#if (SERIAL_BAUD_ACTUAL*100 > SERIAL_BAUD*102) || \
+		(SERIAL_BAUD_ACTUAL*100 < SERIAL_BAUD*98)
+#warning "SERIAL_BAUD is more than 2% off at this F_CPU"
+#endif
+
+/* Outgoing ring buffer size, must be a power of two up to 256 */
+#define SERIAL_TX_SIZE 256
+#define SERIAL_TX_MASK (SERIAL_TX_SIZE - 1)
+
+/* Incoming ring buffer size, must be a power of two up to 256 */
+#define SERIAL_RX_SIZE 64
+#define SERIAL_RX_MASK (SERIAL_RX_SIZE - 1)
+
+extern volatile uint16_t serial_tx_dropped;
+extern volatile uint16_t serial_rx_dropped;
+extern volatile uint16_t serial_rx_overruns;
+extern volatile unsigned char noteLines;
 
 /* Enable serial send/rcv */
 void setup_serial(void);
 
+/* Change the baud rate at runtime */
+void serial_set_baud(uint32_t baud);
+
+/* Take a received character, returns 0 if none - main loop only */
+uint8_t serial_getc(char* c);
+
+/* Nonzero if a received character is waiting */
+uint8_t serial_rx_pending(void);
+
+/* Add a character to outgoing buffer */
+void output_char(char c);
+
 /* Add string to outgoing buffer */
 void output_string(char* str);
 
+/* Add string stored in flash (PSTR) to outgoing buffer */
+void output_string_P(PGM_P str);
+
+/* Add an unsigned decimal number to outgoing buffer */
+void output_number(uint32_t n);
+
 /* Abstraction to provide output_string text corresonding
  ** to the current note.
  */
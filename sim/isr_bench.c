@@ -0,0 +1,357 @@
+/* isr_bench.c
+**
+** Cycle-accurate interrupt handler benchmark. Runs the real
+** firmware image under simavr, scripts button (PINA) and serial
+** input for every waveform, octave and triWaveSteps setting,
+** and measures each handler from the cycle its vector is taken
+** to its reti.
+**
+** For every scenario and handler one JSON object is printed
+** per line, with the call count, min/avg/max cycles per call,
+** min/avg/max interrupt latency (cycles from the interrupt flag
+** being raised to the vector being taken) and the share of CPU
+** time spent in the handler. Interrupts raised while the CPU
+** slept (power.h) are also counted apart, with their wakeup
+** latency to the vector being taken, and each line carries the
+** scenario's share of time asleep. The scenarios with no key
+** held show the silent, gated audio path.
+**
+** Usage: isr_bench firmware.elf [-m mcu] [-t ms]
+**   -m  simavr core to run (default atmega128, which has the
+**       same peripherals and vector table as the ATmega64)
+**   -t  measurement window per scenario in ms (default 200)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/sim_interrupts.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_uart.h>
+/* Only the wave numbers are used from the firmware header */
+#define PGM_P const char*
+#include "wavetable.h"
+
+#define F_CPU 8000000UL
+#define MS (F_CPU/1000)
+
+/* Handlers measured, by ATmega64 vector number */
+typedef struct {
+	const char* name;
+	uint8_t vector;
+	avr_cycle_count_t pending_at;
+	avr_cycle_count_t entered_at;
+	uint8_t pending;
+	uint8_t running;
+	uint32_t calls;
+	uint32_t min, max;
+	uint64_t total;
+	uint32_t lat_min, lat_max;
+	uint64_t lat_total;
+	uint8_t woke;		//pending while asleep
+	uint32_t wakes;
+	uint32_t wake_max;
+	uint64_t wake_total;
+} isr_t;
+
+static isr_t isrs[] = {
+	{ "TIMER2_COMP", 9 },
+	{ "TIMER1_COMPA", 12 },
+	{ "USART0_RX", 18 },
+	{ "USART0_UDRE", 19 },
+	{ "EE_READY", 22 },
+};
+#define NUM_ISRS (sizeof(isrs)/sizeof(isrs[0]))
+
+/* As in wavetable.c */
+static const char* waveNames[NUM_WAVES] = {
+	"Square", "Triangle", "Sine", "Saw", "Organ"
+};
+
+static avr_t* avr;
+static avr_irq_t* buttons[8];
+static avr_irq_t* uart_in;
+static avr_cycle_count_t sleepCycles;
+
+
+static void isr_reset(void) {
+	
+	unsigned i;
+	
+	for (i=0; i<NUM_ISRS; i++) {
+		isrs[i].calls = 0;
+		isrs[i].total = 0;
+		isrs[i].min = UINT32_MAX;
+		isrs[i].max = 0;
+		isrs[i].lat_total = 0;
+		isrs[i].lat_min = UINT32_MAX;
+		isrs[i].lat_max = 0;
+		isrs[i].wakes = 0;
+		isrs[i].wake_max = 0;
+		isrs[i].wake_total = 0;
+	}
+	sleepCycles = 0;
+}
+
+static void on_pending(struct avr_irq_t* irq, uint32_t value, void* param) {
+	
+	isr_t* isr = param;
+	
+	if (value && !isr->pending) {
+		isr->pending_at = avr->cycle;
+		isr->woke = (avr->state == cpu_Sleeping);
+	}
+	isr->pending = value ? 1 : 0;
+}
+
+static void on_running(struct avr_irq_t* irq, uint32_t value, void* param) {
+	
+	isr_t* isr = param;
+	uint32_t cycles;
+	
+	if (value) {
+		isr->entered_at = avr->cycle;
+		isr->running = 1;
+		cycles = (uint32_t)(avr->cycle - isr->pending_at);
+		isr->lat_total += cycles;
+		if (cycles < isr->lat_min) isr->lat_min = cycles;
+		if (cycles > isr->lat_max) isr->lat_max = cycles;
+		if (isr->woke) {
+			isr->woke = 0;
+			isr->wakes++;
+			isr->wake_total += cycles;
+			if (cycles > isr->wake_max) isr->wake_max = cycles;
+		}
+		return;
+	}
+	if (!isr->running) {
+		return;
+	}
+	isr->running = 0;
+	cycles = (uint32_t)(avr->cycle - isr->entered_at);
+	isr->calls++;
+	isr->total += cycles;
+	if (cycles < isr->min) isr->min = cycles;
+	if (cycles > isr->max) isr->max = cycles;
+}
+
+static void on_uart_out(struct avr_irq_t* irq, uint32_t value, void* param) {
+	/* Serial output is discarded */
+}
+
+
+/* Run the simulation for the given number of cycles, counting
+** the time asleep
+*/
+static int run(avr_cycle_count_t cycles) {
+	
+	avr_cycle_count_t end = avr->cycle + cycles, before;
+	int state, sleeping;
+	
+	while (avr->cycle < end) {
+		before = avr->cycle;
+		sleeping = (avr->state == cpu_Sleeping);
+		state = avr_run(avr);
+		if (sleeping) {
+			sleepCycles += avr->cycle - before;
+		}
+		if ((state == cpu_Done) || (state == cpu_Crashed)) {
+			fprintf(stderr, "isr_bench: simulation stopped (state %d)\n", state);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Type serial commands, a byte every 2ms (9600 baud with
+** room for the reply)
+*/
+static int send(const char* cmd) {
+	
+	while (*cmd) {
+		avr_raise_irq(uart_in, (uint8_t)*cmd++);
+		if (run(2*MS)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void press(uint8_t pins) {
+	
+	int i;
+	
+	for (i=0; i<8; i++) {
+		avr_raise_irq(buttons[i], (pins >> i) & 1);
+	}
+}
+
+
+/* Boot the firmware, configure it over serial, hold the given
+** buttons and measure for window_ms. With save, a short
+** recording is made first and stopped just before the window,
+** so that its save to the EEPROM runs during it.
+*/
+static int scenario(uint8_t wave, uint8_t octave, uint8_t steps,
+		uint8_t keys, uint8_t save, unsigned window_ms) {
+	
+	avr_cycle_count_t start;
+	unsigned i;
+	double window;
+	
+	avr_reset(avr);
+	press(0);
+	if (run(20*MS)) {
+		return -1;
+	}
+	
+	/* Waveform 0 after reset; 'W' steps, 'U' toggles the octave,
+	** '<'/'>' move triWaveSteps from its default of 8
+	*/
+	for (i=0; i<wave; i++) {
+		if (send("W ")) return -1;
+	}
+	if (octave && send("U ")) return -1;
+	for (i=8; i>steps; i--) {
+		if (send("< ")) return -1;
+	}
+	for (i=8; i<steps; i++) {
+		if (send("> ")) return -1;
+	}
+	
+	if (save) {
+		if (send("R ")) return -1;
+		for (i=0; i<8; i++) {
+			press(1 << i);
+			if (run(20*MS)) return -1;
+			press(0);
+			if (run(20*MS)) return -1;
+		}
+	}
+	
+	press(keys);
+	if (run(10*MS)) {
+		return -1;
+	}
+	if (save && send("R ")) {
+		return -1;
+	}
+	
+	/* Measure, with one serial command mid-way so that the
+	** RX and UDRE handlers are exercised too
+	*/
+	isr_reset();
+	start = avr->cycle;
+	if (run(window_ms*MS/2)) return -1;
+	avr_raise_irq(uart_in, 'A');
+	if (run(window_ms*MS - window_ms*MS/2)) return -1;
+	window = (double)(avr->cycle - start);
+	
+	for (i=0; i<NUM_ISRS; i++) {
+		isr_t* isr = &isrs[i];
+		printf("{\"wave\":\"%s\",\"octave\":%u,\"steps\":%u,\"keys\":%u,\"save\":%u,"
+			"\"isr\":\"%s\",\"calls\":%u,",
+			waveNames[wave], octave, steps, __builtin_popcount(keys), save,
+			isr->name, isr->calls);
+		if (isr->calls) {
+			printf("\"min\":%u,\"avg\":%.1f,\"max\":%u,"
+				"\"lat_min\":%u,\"lat_avg\":%.1f,\"lat_max\":%u,",
+				isr->min, (double)isr->total/isr->calls, isr->max,
+				isr->lat_min, (double)isr->lat_total/isr->calls, isr->lat_max);
+		}
+		if (isr->wakes) {
+			printf("\"wakes\":%u,\"wake_avg\":%.1f,\"wake_max\":%u,",
+				isr->wakes, (double)isr->wake_total/isr->wakes, isr->wake_max);
+		}
+		printf("\"cpu_pct\":%.3f,\"sleep_pct\":%.3f}\n",
+			100.0*isr->total/window, 100.0*sleepCycles/window);
+	}
+	fflush(stdout);
+	return 0;
+}
+
+
+int main(int argc, char** argv) {
+	
+	const char* mcu = "atmega128";
+	unsigned window_ms = 200;
+	elf_firmware_t fw;
+	uint32_t flags = 0;
+	unsigned i;
+	int opt;
+	uint8_t wave, octave, k;
+	static const uint8_t keySets[] = { 0x00, 0x01, 0x0F };
+	static const uint8_t triSteps[] = { 4, 8, 16 };
+	
+	while ((opt = getopt(argc, argv, "m:t:")) != -1) {
+		switch (opt) {
+		case 'm': mcu = optarg; break;
+		case 't': window_ms = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s firmware.elf [-m mcu] [-t ms]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "usage: %s firmware.elf [-m mcu] [-t ms]\n", argv[0]);
+		return 1;
+	}
+	
+	memset(&fw, 0, sizeof(fw));
+	if (elf_read_firmware(argv[optind], &fw) != 0) {
+		fprintf(stderr, "isr_bench: cannot read %s\n", argv[optind]);
+		return 1;
+	}
+	avr = avr_make_mcu_by_name(mcu);
+	if (!avr) {
+		fprintf(stderr, "isr_bench: unknown mcu %s\n", mcu);
+		return 1;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr->frequency = F_CPU;
+	
+	/* Hook the handlers' pending and running signals */
+	for (i=0; i<NUM_ISRS; i++) {
+		avr_irq_t* irq = avr_get_interrupt_irq(avr, isrs[i].vector);
+		avr_irq_register_notify(irq + AVR_INT_IRQ_PENDING, on_pending, &isrs[i]);
+		avr_irq_register_notify(irq + AVR_INT_IRQ_RUNNING, on_running, &isrs[i]);
+	}
+	
+	/* Inputs, and a silent UART */
+	for (i=0; i<8; i++) {
+		buttons[i] = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('A'), IOPORT_IRQ_PIN0 + i);
+	}
+	uart_in = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+		on_uart_out, NULL);
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+	
+	for (wave=0; wave<NUM_WAVES; wave++) {
+		for (octave=0; octave<2; octave++) {
+			for (i=0; i<sizeof(triSteps); i++) {
+				/* Only the triangle depends on triWaveSteps */
+				if ((wave != WAVE_TRIANGLE) && (triSteps[i] != 8)) {
+					continue;
+				}
+				for (k=0; k<sizeof(keySets); k++) {
+					if (scenario(wave, octave, triSteps[i], keySets[k], 0, window_ms)) {
+						return 1;
+					}
+				}
+			}
+		}
+	}
+	
+	/* Saving a recording, for the EEPROM ready handler */
+	if (scenario(WAVE_SQUARE, 0, 8, 0x01, 1, window_ms)) {
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,344 @@
+/* key_latency.c
+**
+** End-to-end button latency benchmark. Runs the real firmware
+** image under simavr and measures, for repeated presses, the time
+** from a PINA rising edge to the last bit of the first D2A frame
+** on the SPI bus whose sample differs from silence. That covers
+** the 1ms key scan and debounce, the main loop taking the key
+** event (handleKeyEvents, start_note and the note's serial
+** output), the render FIFO and the Timer 1 sample handler.
+**
+** Each press comes at a random offset from the last, so the
+** edge falls at every phase of the key scan and sample clocks.
+** Scenarios cover every waveform and octave, with and without
+** serial traffic: a command line arriving every 20ms at 9600
+** baud, whose replies keep the transmitter busy.
+**
+** One JSON object is printed per scenario with the press count,
+** min/mean/p50/p95/p99/max latency in ms and a histogram in 1ms
+** bins. The exit status is 1 if any scenario's p95 or max is
+** over its limit, so regressions fail 'make simlatency'.
+**
+** Usage: key_latency firmware.elf [-m mcu] [-n presses]
+**                    [-p p95-limit-ms] [-x max-limit-ms]
+**   -m  simavr core to run (default atmega128, which has the
+**       same peripherals and vector table as the ATmega64)
+**   -n  presses per scenario (default 100)
+**   -p  limit on the 95th percentile (default 10ms)
+**   -x  limit on the maximum (default 12ms)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/sim_cycle_timers.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_spi.h>
+#include <simavr/avr_uart.h>
+/* Only the wave numbers are used from the firmware header */
+#define PGM_P const char*
+#include "wavetable.h"
+
+#define F_CPU 8000000UL
+#define MS (F_CPU/1000)
+
+/* A byte takes 16 cycles at clk/2; the DAC takes the sample
+** on the last clock of the low byte
+*/
+#define SPI_BYTE_CYCLES 16
+
+/* Silence between presses, longer than the default release */
+#define SILENCE_MS 80
+/* A press that has not sounded by then has failed */
+#define TIMEOUT_MS 50
+
+#define HIST_BINS 16
+
+/* Serial traffic: this line every TRAFFIC_MS, a byte per ms */
+#define TRAFFIC_LINE "audio\r"
+#define TRAFFIC_MS 20
+
+/* As in wavetable.c */
+static const char* waveNames[NUM_WAVES] = {
+	"Square", "Triangle", "Sine", "Saw", "Organ"
+};
+
+static avr_t* avr;
+static avr_irq_t* buttons[8];
+static avr_irq_t* uart_in;
+
+/* D2A frames being clocked out. frameByte counts the bytes since
+** the sync pin went low.
+*/
+static uint8_t frameByte;
+static uint8_t frameHigh;
+static uint16_t lastSample;
+
+/* The press being timed */
+static uint8_t waiting;
+static uint16_t silence;
+static avr_cycle_count_t soundedAt;
+
+/* Position in the traffic line */
+static uint8_t trafficPos;
+
+static double* latency;
+
+
+static void on_sync(struct avr_irq_t* irq, uint32_t value, void* param) {
+	if (value == 0) {
+		frameByte = 0;
+	}
+}
+
+static void on_spi(struct avr_irq_t* irq, uint32_t value, void* param) {
+
+	uint16_t sample;
+
+	if (frameByte++ == 0) {
+		frameHigh = value;
+		return;
+	}
+	sample = ((frameHigh & 0x0F) << 8) | (value & 0xFF);
+	if (waiting && (sample != silence)) {
+		soundedAt = avr->cycle + SPI_BYTE_CYCLES;
+		waiting = 0;
+	}
+	lastSample = sample;
+}
+
+static void on_uart_out(struct avr_irq_t* irq, uint32_t value, void* param) {
+	/* Serial output is discarded */
+}
+
+static avr_cycle_count_t traffic(struct avr_t* avr, avr_cycle_count_t when, void* param) {
+
+	avr_raise_irq(uart_in, (uint8_t)TRAFFIC_LINE[trafficPos++]);
+	if (TRAFFIC_LINE[trafficPos] == 0) {
+		trafficPos = 0;
+		return when + (TRAFFIC_MS - (sizeof(TRAFFIC_LINE) - 2))*MS;
+	}
+	return when + MS;
+}
+
+
+/* Run the simulation for the given number of cycles, or until
+** a press being timed has sounded
+*/
+static int run(avr_cycle_count_t cycles, uint8_t untilSound) {
+
+	avr_cycle_count_t end = avr->cycle + cycles;
+	int state;
+
+	while (avr->cycle < end) {
+		if (untilSound && !waiting) {
+			return 0;
+		}
+		state = avr_run(avr);
+		if ((state == cpu_Done) || (state == cpu_Crashed)) {
+			fprintf(stderr, "key_latency: simulation stopped (state %d)\n", state);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Type serial commands, a byte every 2ms (9600 baud with
+** room for the reply)
+*/
+static int send(const char* cmd) {
+
+	while (*cmd) {
+		avr_raise_irq(uart_in, (uint8_t)*cmd++);
+		if (run(2*MS, 0)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void press(uint8_t pins) {
+
+	int i;
+
+	for (i=0; i<8; i++) {
+		avr_raise_irq(buttons[i], (pins >> i) & 1);
+	}
+}
+
+static int compare(const void* a, const void* b) {
+
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(unsigned n, double p) {
+	return latency[(unsigned)(p * (n - 1) + 0.5)];
+}
+
+
+/* Boot the firmware, configure it over serial and time the given
+** number of presses. Returns 1 if a limit is exceeded.
+*/
+static int scenario(uint8_t wave, uint8_t octave, uint8_t uart,
+		unsigned presses, double p95Limit, double maxLimit) {
+
+	avr_cycle_count_t edge;
+	unsigned i, n = 0, timeouts = 0;
+	unsigned hist[HIST_BINS];
+	double sum = 0.0;
+
+	avr_reset(avr);
+	press(0);
+	waiting = 0;
+	if (run(20*MS, 0)) {
+		return -1;
+	}
+
+	/* Waveform 0 after reset; 'W' steps, 'U' toggles the octave */
+	for (i=0; i<wave; i++) {
+		if (send("W ")) return -1;
+	}
+	if (octave && send("U ")) return -1;
+
+	/* The reset cleared the cycle timers */
+	if (uart) {
+		trafficPos = 0;
+		avr_cycle_timer_register(avr, MS, traffic, NULL);
+	}
+
+	for (i=0; i<presses; i++) {
+		press(0);
+		if (run(SILENCE_MS*MS + rand() % (2*MS), 0)) {
+			return -1;
+		}
+
+		silence = lastSample;
+		waiting = 1;
+		edge = avr->cycle;
+		press(1 << (i % 8));
+		if (run(TIMEOUT_MS*MS, 1)) {
+			return -1;
+		}
+		if (waiting) {
+			waiting = 0;
+			timeouts++;
+			continue;
+		}
+		latency[n] = (double)(soundedAt - edge) * 1000 / F_CPU;
+		sum += latency[n++];
+	}
+	if (uart) {
+		avr_cycle_timer_cancel(avr, traffic, NULL);
+	}
+
+	printf("{\"wave\":\"%s\",\"octave\":%u,\"uart\":%u,\"presses\":%u,\"timeouts\":%u",
+		waveNames[wave], octave, uart, presses, timeouts);
+	if (n) {
+		qsort(latency, n, sizeof(double), compare);
+		memset(hist, 0, sizeof(hist));
+		for (i=0; i<n; i++) {
+			unsigned bin = (unsigned)latency[i];
+			hist[(bin < HIST_BINS) ? bin : HIST_BINS-1]++;
+		}
+		printf(",\"min\":%.3f,\"mean\":%.3f,\"p50\":%.3f,\"p95\":%.3f,\"p99\":%.3f,\"max\":%.3f,"
+			"\"hist_ms\":[",
+			latency[0], sum / n, percentile(n, 0.50), percentile(n, 0.95),
+			percentile(n, 0.99), latency[n-1]);
+		for (i=0; i<HIST_BINS; i++) {
+			printf("%s%u", i ? "," : "", hist[i]);
+		}
+		printf("]");
+	}
+	printf("}\n");
+	fflush(stdout);
+
+	if (timeouts || (n == 0) || (percentile(n, 0.95) > p95Limit) ||
+			(latency[n-1] > maxLimit)) {
+		fprintf(stderr, "key_latency: %s octave %u uart %u over the limit "
+			"(p95 %.2fms, max %.2fms, %u timeouts)\n",
+			waveNames[wave], octave, uart,
+			n ? percentile(n, 0.95) : 0.0, n ? latency[n-1] : 0.0, timeouts);
+		return 1;
+	}
+	return 0;
+}
+
+
+int main(int argc, char** argv) {
+
+	const char* mcu = "atmega128";
+	unsigned presses = 100;
+	double p95Limit = 10.0, maxLimit = 12.0;
+	elf_firmware_t fw;
+	uint32_t flags = 0;
+	unsigned i;
+	int opt, r, failed = 0;
+	uint8_t wave, octave, uart;
+
+	while ((opt = getopt(argc, argv, "m:n:p:x:")) != -1) {
+		switch (opt) {
+		case 'm': mcu = optarg; break;
+		case 'n': presses = atoi(optarg); break;
+		case 'p': p95Limit = atof(optarg); break;
+		case 'x': maxLimit = atof(optarg); break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+	if ((optind >= argc) || (presses == 0)) {
+		fprintf(stderr, "usage: %s firmware.elf [-m mcu] [-n presses] "
+			"[-p p95-limit-ms] [-x max-limit-ms]\n", argv[0]);
+		return 2;
+	}
+	latency = malloc(presses * sizeof(double));
+
+	memset(&fw, 0, sizeof(fw));
+	if (elf_read_firmware(argv[optind], &fw) != 0) {
+		fprintf(stderr, "key_latency: cannot read %s\n", argv[optind]);
+		return 2;
+	}
+	avr = avr_make_mcu_by_name(mcu);
+	if (!avr) {
+		fprintf(stderr, "key_latency: unknown mcu %s\n", mcu);
+		return 2;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr->frequency = F_CPU;
+
+	/* Inputs, the D2A bus (sync is PB0) and a silent UART */
+	for (i=0; i<8; i++) {
+		buttons[i] = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('A'), IOPORT_IRQ_PIN0 + i);
+	}
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), IOPORT_IRQ_PIN0),
+		on_sync, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ('0'), SPI_IRQ_OUTPUT),
+		on_spi, NULL);
+	uart_in = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+		on_uart_out, NULL);
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+
+	srand(1);
+	for (wave=0; wave<NUM_WAVES; wave++) {
+		for (octave=0; octave<2; octave++) {
+			for (uart=0; uart<2; uart++) {
+				r = scenario(wave, octave, uart, presses, p95Limit, maxLimit);
+				if (r < 0) {
+					return 2;
+				}
+				failed |= r;
+			}
+		}
+	}
+	return failed;
+}
@@ -0,0 +1,372 @@
+/* store.c
+**
+** Recordings saved to EEPROM as a wear levelled log (see
+** store.h).
+*/
+
+#include "hal.h"
+#include "playback.h"
+#include "profile.h"
+#include "power.h"
+#include "serial.h"
+#include "wavetable.h"
+#include "store.h"
+
+#define STORE_MASK (HAL_EEPROM_SIZE-1)
+
+/* Bytes the ready interrupt may compare before it returns, when
+** they already hold the value to be written
+*/
+#define STORE_COMPARES 8
+
+store_slot_t store_slots[STORE_SLOTS];
+volatile uint8_t store_busy = 0;
+
+static uint16_t storeHead = 0;
+	//where the next record starts looking for space
+static uint16_t storeSeq = 0;
+	//seq of the newest record
+
+/* The record being written. The ISR owns these while
+** store_busy is set and sets writeDone when the last byte is
+** in, for store_poll.
+*/
+static uint8_t writeHeader[STORE_HEADER];
+static uint8_t writeTrailer[STORE_TRAILER];
+static uint16_t writeStart;
+static uint16_t writeAddr;
+static uint16_t writePos;
+static uint16_t writeSize;
+static volatile uint8_t writeDone = 0;
+
+/* Slot of a save waiting for the one being written, or 255 */
+static uint8_t saveQueued = 255;
+
+
+/* Record size for a recording of len bytes */
+static uint16_t record_size(uint16_t len) {
+	return STORE_HEADER + len + STORE_TRAILER;
+}
+
+/* CRC-16 (CCITT polynomial), continued from *sum. Unlike a
+** mod 255 sum this notices bytes changed between 0x00 and
+** 0xFF, as erased EEPROM reads.
+*/
+static void checksum_add(uint16_t* sum, uint8_t c) {
+
+	uint16_t crc = *sum;
+
+	crc = (crc >> 8) | (crc << 8);
+	crc ^= c;
+	crc ^= (crc & 0xFF) >> 4;
+	crc ^= crc << 12;
+	crc ^= (crc & 0xFF) << 5;
+	*sum = crc;
+}
+
+/* 1 if seq a is newer than seq b (allowing for wrap) */
+static uint8_t seq_newer(uint16_t a, uint16_t b) {
+	return (int16_t)(a - b) > 0;
+}
+
+
+/* Check for a valid record at addr, filling in its header.
+** Returns the recording length, or 0 if there is none.
+*/
+static uint16_t record_check(uint16_t addr, uint8_t* header) {
+
+	uint16_t len, i, sum = 0xFFFF;
+
+	for (i=0; i<STORE_HEADER; i++) {
+		header[i] = hal_eeprom_read((addr + i) & STORE_MASK);
+		if ((i==0) && (header[0] != STORE_MAGIC)) {
+			return 0;
+		}
+		checksum_add(&sum, header[i]);
+	}
+	len = header[4] | ((uint16_t)header[5] << 8);
+	if ((header[1] >= STORE_SLOTS) || (len == 0) || (len > REC_BUFSIZE) ||
+			(header[6] >= NUM_WAVES)) {
+		return 0;
+	}
+	addr += STORE_HEADER;
+	for (i=0; i<len; i++) {
+		checksum_add(&sum, hal_eeprom_read(addr++ & STORE_MASK));
+	}
+	if ((hal_eeprom_read(addr & STORE_MASK) != (sum & 0xFF)) ||
+			(hal_eeprom_read((addr + 1) & STORE_MASK) != (sum >> 8))) {
+		return 0;
+	}
+	return len;
+}
+
+
+void store_restore(void) {
+
+	uint8_t header[STORE_HEADER];
+	uint16_t addr = 0, len, seq;
+	uint8_t slot, newest = STORE_SLOTS;
+	store_slot_t* s;
+
+	for (slot=0; slot<STORE_SLOTS; slot++) {
+		store_slots[slot].length = 0;
+	}
+	storeHead = 0;
+
+	/* Find the newest record of each slot. Records never
+	** overlap a live one, so the scan can skip past each
+	** record found.
+	*/
+	while (addr < HAL_EEPROM_SIZE) {
+		len = record_check(addr, header);
+		if (len == 0) {
+			addr++;
+			continue;
+		}
+		slot = header[1];
+		seq = header[2] | ((uint16_t)header[3] << 8);
+		s = &store_slots[slot];
+		if ((s->length == 0) || seq_newer(seq, s->seq)) {
+			s->addr = addr;
+			s->length = len;
+			s->seq = seq;
+		}
+		if ((newest == STORE_SLOTS) || seq_newer(seq, storeSeq)) {
+			newest = slot;
+			storeSeq = seq;
+		}
+		addr += record_size(len);
+	}
+
+	/* Carry on the log after the newest record, and load it */
+	if (newest != STORE_SLOTS) {
+		s = &store_slots[newest];
+		storeHead = (s->addr + record_size(s->length)) & STORE_MASK;
+		store_load(newest);
+	}
+}
+
+
+/* Overlap of two regions of the circular log */
+static uint8_t overlaps(uint16_t a, uint16_t asize, uint16_t b, uint16_t bsize) {
+	return (((b - a) & STORE_MASK) < asize) || (((a - b) & STORE_MASK) < bsize);
+}
+
+/* Move storeHead to the first gap at or after it that holds
+** size bytes without touching a live record. Each record in
+** the way moves the head past its end, so every gap is tried
+** within two passes.
+*/
+static uint8_t store_alloc(uint16_t size) {
+
+	uint8_t i, tries, blocked;
+	store_slot_t* s;
+
+	if (size > HAL_EEPROM_SIZE) {
+		return 0;
+	}
+	for (tries=0; tries<2*STORE_SLOTS+1; tries++) {
+		blocked = 0;
+		for (i=0; i<STORE_SLOTS; i++) {
+			s = &store_slots[i];
+			if ((s->length != 0) &&
+					overlaps(storeHead, size, s->addr, record_size(s->length))) {
+				storeHead = (s->addr + record_size(s->length)) & STORE_MASK;
+				blocked = 1;
+				break;
+			}
+		}
+		if (!blocked) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+uint8_t store_save(uint8_t slot) {
+
+	uint16_t i, sum = 0xFFFF;
+	uint16_t len = rec_length;
+
+	if (store_busy) {
+		return STORE_BUSY;
+	}
+	if ((len == 0) || (slot >= STORE_SLOTS)) {
+		return STORE_EMPTY;
+	}
+	if (!store_alloc(record_size(len))) {
+		return STORE_FULL;
+	}
+
+	writeHeader[0] = STORE_MAGIC;
+	writeHeader[1] = slot;
+	writeHeader[2] = (storeSeq + 1) & 0xFF;
+	writeHeader[3] = (storeSeq + 1) >> 8;
+	writeHeader[4] = len & 0xFF;
+	writeHeader[5] = len >> 8;
+	writeHeader[6] = rec_waveform;
+	writeHeader[7] = rec_octave;
+	writeHeader[8] = rec_beatset & 0xFF;
+	writeHeader[9] = rec_beatset >> 8;
+	for (i=0; i<STORE_HEADER; i++) {
+		checksum_add(&sum, writeHeader[i]);
+	}
+	for (i=0; i<len; i++) {
+		checksum_add(&sum, rec_buffer[i]);
+	}
+	writeTrailer[0] = sum & 0xFF;
+	writeTrailer[1] = sum >> 8;
+
+	/* The interrupt fires at once, as no write is in progress */
+	writeStart = storeHead;
+	writeAddr = storeHead;
+	writePos = 0;
+	writeSize = record_size(len);
+	storeSeq++;
+	store_busy = 1;
+	if (slot == saveQueued) {
+		saveQueued = 255;
+	}
+	hal_eeprom_irq_enable();
+	return STORE_OK;
+}
+
+
+uint8_t store_save_queued(uint8_t slot) {
+
+	uint8_t result = store_save(slot);
+
+	if (result == STORE_BUSY) {
+		saveQueued = slot;
+		result = STORE_OK;
+	}
+	return result;
+}
+
+
+void store_print_result(uint8_t result) {
+	switch (result) {
+	case STORE_BUSY:
+		output_string_P(PSTR("\r\n-Busy- "));
+		break;
+	case STORE_EMPTY:
+		output_string_P(PSTR("\r\n-Empty- "));
+		break;
+	case STORE_FULL:
+		output_string_P(PSTR("\r\n-EepromFull- "));
+		break;
+	}
+}
+
+
+uint8_t store_load(uint8_t slot) {
+
+	uint8_t header[STORE_HEADER];
+	store_slot_t* s;
+	uint16_t i;
+
+	if (store_busy) {
+		return STORE_BUSY;
+	}
+	if ((slot >= STORE_SLOTS) || (store_slots[slot].length == 0)) {
+		return STORE_EMPTY;
+	}
+	s = &store_slots[slot];
+
+	/* Read the header back rather than keep it in RAM */
+	for (i=0; i<STORE_HEADER; i++) {
+		header[i] = hal_eeprom_read((s->addr + i) & STORE_MASK);
+	}
+	for (i=0; i<s->length; i++) {
+		rec_buffer[i] = hal_eeprom_read((s->addr + STORE_HEADER + i) & STORE_MASK);
+	}
+	rec_length = s->length;
+	rec_waveform = header[6];
+	rec_octave = header[7];
+	rec_beatset = header[8] | ((uint16_t)header[9] << 8);
+	tracks_scan();
+	return STORE_OK;
+}
+
+
+void store_poll(void) {
+
+	store_slot_t* s;
+	uint8_t slot;
+
+	/* A queued save starts once the last one is done, but not
+	** part way through a recording
+	*/
+	if ((saveQueued != 255) && !store_busy && !recording) {
+		slot = saveQueued;
+		saveQueued = 255;
+		store_print_result(store_save(slot));
+	}
+
+	if (!writeDone) {
+		return;
+	}
+	writeDone = 0;
+
+	/* The new record replaces the slot's old one, which
+	** becomes free space
+	*/
+	s = &store_slots[writeHeader[1]];
+	s->addr = writeStart;
+	s->length = writeSize - STORE_HEADER - STORE_TRAILER;
+	s->seq = storeSeq;
+	storeHead = (writeStart + writeSize) & STORE_MASK;
+	store_busy = 0;
+}
+
+
+uint8_t store_pending(void) {
+	return writeDone;
+}
+
+
+/*
+ * Define the interrupt handler for EEPROM Ready (i.e. the last
+ * byte has been written). Write the next byte of the record that
+ * differs from what is already there.
+ */
+ISR(EE_READY_vect)
+{
+	uint8_t compares = STORE_COMPARES;
+	uint8_t c;
+	uint16_t addr;
+
+	POWER_WAKE();
+	PROF_ENTER(PROF_EEPROM);
+
+	while (writePos < writeSize) {
+		if (writePos < STORE_HEADER) {
+			c = writeHeader[writePos];
+		} else if (writePos < writeSize - STORE_TRAILER) {
+			c = rec_buffer[writePos - STORE_HEADER];
+		} else {
+			c = writeTrailer[writePos - (writeSize - STORE_TRAILER)];
+		}
+		addr = writeAddr;
+		writeAddr = (writeAddr + 1) & STORE_MASK;
+		writePos++;
+
+		if (hal_eeprom_read(addr) != c) {
+			hal_eeprom_write(addr, c);
+			PROF_EXIT(PROF_EEPROM);
+			return;
+		}
+		if (--compares == 0) {
+			/* Fires again straight away */
+			PROF_EXIT(PROF_EEPROM);
+			return;
+		}
+	}
+
+	/* The last write has finished */
+	hal_eeprom_irq_disable();
+	writeDone = 1;
+
+	PROF_EXIT(PROF_EEPROM);
+}
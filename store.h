@@ -0,0 +1,76 @@
+/* store.h
+**
+** Recordings saved to EEPROM. Each save appends a record to a
+** log that wraps around the whole EEPROM:
+**
+**   magic, slot, seq (2), length (2), waveform, octave,
+**   beat (2), the recording (length bytes), checksum (2)
+**
+** The newest valid record of each slot (highest seq) is its
+** content; older records are free space. A new record goes at
+** the log head, skipping over live records, so writes rotate
+** through the free space and a record is never erased before
+** its replacement is complete. Unchanged bytes aren't rewritten.
+**
+** Writes run from the EEPROM ready interrupt, one byte per
+** write time, so the main loop and audio never wait for them.
+** Slot 0 holds the last recording, saved when it stops; at
+** start up the newest valid record of any slot is loaded back.
+*/
+
+#ifndef STORE_H
+#define STORE_H
+
+#define STORE_SLOTS 4
+#define STORE_SESSION_SLOT 0
+
+#define STORE_MAGIC 0xA5
+#define STORE_HEADER 10
+#define STORE_TRAILER 2
+
+/* Result of store_save/store_load */
+#define STORE_OK 0
+#define STORE_BUSY 1		//a save is in progress
+#define STORE_EMPTY 2		//nothing to save/load
+#define STORE_FULL 3		//no gap large enough
+
+/* Index of the saved slots, built at start up */
+typedef struct {
+	uint16_t addr;
+	uint16_t length;	//0 if the slot is empty
+	uint16_t seq;
+} store_slot_t;
+
+extern store_slot_t store_slots[STORE_SLOTS];
+
+/* Nonzero while a save is being written */
+extern volatile uint8_t store_busy;
+
+/* Scan the EEPROM, build the index and load the newest
+** recording. Call once at start up.
+*/
+void store_restore(void);
+
+/* Start saving the current recording to a slot. Main loop
+** only; recording and loading wait until the save is done.
+*/
+uint8_t store_save(uint8_t slot);
+
+/* Save to a slot, or if a save is being written, save to it
+** as soon as that is done. Main loop only.
+*/
+uint8_t store_save_queued(uint8_t slot);
+
+/* Print why a save or load failed, if it did */
+void store_print_result(uint8_t result);
+
+/* Load a slot as the current recording */
+uint8_t store_load(uint8_t slot);
+
+/* Finish a completed save - main loop */
+void store_poll(void);
+
+/* Nonzero if a finished save is waiting for store_poll */
+uint8_t store_pending(void);
+
+#endif
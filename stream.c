@@ -0,0 +1,209 @@
+/* stream.c
+**
+** PCM streaming mode (see stream.h). The jitter buffer has a
+** single producer (serial receive interrupt) and a single
+** consumer (main loop), like the audio FIFO. Its indices run
+** freely over 0..255, so head-tail is the fill level and at
+** most 255 bytes are buffered.
+*/
+
+#include "hal.h"
+#include "d2a.h"
+#include "notes.h"
+#include "serial.h"
+#include "audio.h"
+#include "stream.h"
+
+static uint8_t stream_buf[STREAM_BUF_SIZE];
+static volatile uint8_t stream_head = 0;
+static volatile uint8_t stream_tail = 0;
+
+/* Resampler phase and step: a byte is taken each time the
+** 16-bit phase wraps, i.e. step = 65536*rate/AUDIO_SAMPLE_RATE
+*/
+static uint16_t stream_phase;
+static uint16_t stream_step;
+static uint16_t stream_last;
+
+static uint8_t stream_playing;		//0 while prebuffering
+static uint8_t stream_starved;		//ran dry, not yet counted
+static volatile uint8_t stream_xoff;	//XOFF sent, waiting to send XON
+static volatile uint8_t stream_rx_seen;	//set by each received byte
+static uint16_t stream_idle_ms;
+static uint16_t stream_quiet_ms;
+
+volatile uint8_t stream_active = 0;
+volatile uint8_t stream_target = STREAM_TARGET_INIT;
+volatile uint16_t stream_underruns = 0;
+volatile uint16_t stream_overruns = 0;
+
+
+void stream_start(uint16_t rate) {
+
+	uint32_t step;
+
+	if (rate<STREAM_MIN_RATE) {
+		rate = STREAM_MIN_RATE;
+	}
+	step = ((uint32_t)rate << 16) / AUDIO_SAMPLE_RATE;
+	if (step>0xFFFF) {
+		step = 0xFFFF;
+	}
+
+	quiet();
+	audio_wake();
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		stream_head = stream_tail = 0;
+		stream_xoff = 0;
+		stream_rx_seen = 0;
+		stream_underruns = 0;
+		stream_overruns = 0;
+		stream_target = STREAM_TARGET_INIT;
+		stream_active = 1;
+	}
+	stream_step = step;
+	stream_phase = 0;
+	stream_last = D2A_MIDSCALE;
+	stream_playing = 0;
+	stream_starved = 0;
+	stream_idle_ms = 0;
+	stream_quiet_ms = 0;
+
+	output_string_P(PSTR("\r\n-Stream:"));
+	output_number(rate);
+	output_string_P(PSTR("- "));
+	output_char(STREAM_XON);
+}
+
+
+void stream_stop(void) {
+
+	stream_active = 0;
+
+	output_string_P(PSTR("\r\n-StreamEnd- Underruns:"));
+	output_number(stream_underruns);
+	output_string_P(PSTR(" Overruns:"));
+	output_number(stream_overruns);
+	output_string_P(PSTR(" Target:"));
+	output_number(stream_target);
+	output_string_P(PSTR(" "));
+}
+
+
+uint8_t stream_level(void) {
+	return stream_head - stream_tail;
+}
+
+
+void stream_rx(uint8_t c) {
+
+	uint8_t fill = stream_head - stream_tail;
+
+	stream_rx_seen = 1;
+
+	if (fill == STREAM_BUF_SIZE-1) {
+		stream_overruns++;
+		return;
+	}
+	stream_buf[stream_head] = c;
+	stream_head++;
+
+	/* Pause the host before the buffer fills */
+	if (!stream_xoff && (fill+1 >= stream_target + STREAM_HYSTERESIS)) {
+		stream_xoff = 1;
+		output_char(STREAM_XOFF);
+	}
+}
+
+
+void stream_render(uint16_t* buf, uint8_t n) {
+
+	uint8_t i;
+	uint8_t tail = stream_tail;
+	uint16_t phase = stream_phase;
+
+	for (i=0; i<n; i++) {
+
+		/* Next byte due? Hold the last sample if there is
+		** none, and prebuffer again.
+		*/
+		phase += stream_step;
+		if ((phase < stream_step) && stream_playing) {
+			if (tail != stream_head) {
+				stream_last = (uint16_t)stream_buf[tail] << 4;
+				tail++;
+			} else {
+				stream_playing = 0;
+				stream_starved = 1;
+			}
+		}
+		buf[i] = stream_last;
+	}
+	stream_phase = phase;
+	stream_tail = tail;
+
+	if (!stream_playing) {
+		
+		/* Running dry only counts as an underrun once more data
+		** arrives, so the end of a stream is not one. The target
+		** is raised for the rest of the stream.
+		*/
+		if (stream_starved && (tail != stream_head)) {
+			stream_starved = 0;
+			stream_underruns++;
+			stream_quiet_ms = 0;
+			if (stream_target <= STREAM_TARGET_MAX-STREAM_TARGET_UP) {
+				stream_target += STREAM_TARGET_UP;
+			}
+		}
+		if ((uint8_t)(stream_head - tail) >= stream_target) {
+			stream_playing = 1;
+		}
+	}
+
+	/* Resume the host once drained to the target */
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (stream_xoff && ((uint8_t)(stream_head - tail) <= stream_target)) {
+			stream_xoff = 0;
+			output_char(STREAM_XON);
+		}
+	}
+}
+
+
+void stream_tick(void) {
+
+	uint8_t seen;
+
+	if (!stream_active) {
+		return;
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		seen = stream_rx_seen;
+		stream_rx_seen = 0;
+	}
+
+	/* End of stream: no data for a while. Play out anything
+	** left short of the target, then stop.
+	*/
+	if (seen) {
+		stream_idle_ms = 0;
+	} else if (++stream_idle_ms >= STREAM_TIMEOUT_MS) {
+		stream_idle_ms = STREAM_TIMEOUT_MS;
+		if (stream_level()==0) {
+			stream_stop();
+			return;
+		}
+		stream_playing = 1;
+	}
+
+	/* Lower the target again after a period without underruns */
+	if (++stream_quiet_ms >= STREAM_ADAPT_MS) {
+		stream_quiet_ms = 0;
+		if (stream_target >= STREAM_TARGET_MIN+STREAM_TARGET_DOWN) {
+			stream_target -= STREAM_TARGET_DOWN;
+		}
+	}
+}
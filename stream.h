@@ -0,0 +1,66 @@
+/* stream.h
+**
+** PCM streaming mode: 8-bit unsigned samples received over the
+** serial port are played through the audio FIFO at a fixed
+** sample rate, in place of the synthesiser.
+**
+** The receive interrupt feeds a jitter buffer; the main loop
+** resamples it to AUDIO_SAMPLE_RATE. Playback starts once
+** stream_target bytes are buffered. The target grows after an
+** underrun and shrinks again after a quiet period, so latency
+** follows the jitter of the link. The host is paced with
+** XON/XOFF bytes. Streaming ends after STREAM_TIMEOUT_MS with
+** no data.
+*/
+
+#ifndef STREAM_H
+#define STREAM_H
+
+/* The buffer indices wrap naturally, so it must be 256 bytes */
+#define STREAM_BUF_SIZE 256
+
+/* Jitter buffer target limits and adaptation, in bytes */
+#define STREAM_TARGET_INIT 64
+#define STREAM_TARGET_MIN 16
+#define STREAM_TARGET_MAX 160
+#define STREAM_TARGET_UP 32		//added after an underrun
+#define STREAM_TARGET_DOWN 8		//removed after a quiet period
+#define STREAM_ADAPT_MS 2000		//length of a quiet period
+
+/* XOFF is sent at stream_target+STREAM_HYSTERESIS bytes, XON
+** when the buffer has drained back to stream_target
+*/
+#define STREAM_HYSTERESIS 32
+#define STREAM_XON 0x11
+#define STREAM_XOFF 0x13
+
+#define STREAM_DEFAULT_RATE 8000
+#define STREAM_MIN_RATE 1000
+#define STREAM_TIMEOUT_MS 250
+
+extern volatile uint8_t stream_active;
+extern volatile uint8_t stream_target;
+extern volatile uint16_t stream_underruns;	//buffer empty while playing
+extern volatile uint16_t stream_overruns;	//bytes dropped, buffer full
+
+/* Enter streaming mode at the given sample rate (Hz) */
+void stream_start(uint16_t rate);
+
+/* Leave streaming mode and report the statistics */
+void stream_stop(void);
+
+/* Bytes currently buffered */
+uint8_t stream_level(void);
+
+/* Queue a received byte - serial receive interrupt only */
+void stream_rx(uint8_t c);
+
+/* Render n samples from the buffer - main loop, in place of
+** synth_render() while stream_active
+*/
+void stream_render(uint16_t* buf, uint8_t n);
+
+/* Timeout and target adaptation, 1ms task */
+void stream_tick(void);
+
+#endif
@@ -0,0 +1,111 @@
+/* tempo.c
+**
+** Beat clock (see tempo.h).
+*/
+
+#include "hal.h"
+#include "sched.h"
+#include "tempo.h"
+
+volatile uint16_t tempo_bpm = TEMPO_DEFAULT;
+volatile uint8_t tempo_swing = TEMPO_SWING_MIN;
+volatile uint32_t tempo_beats = 0;
+
+static uint32_t tempoPhase = 0;
+	//position in the beat, 0..TEMPO_BEAT
+static uint8_t tempoTick = 1;
+	//the next tick, TEMPO_SUBDIV for the next beat
+static uint32_t tempoNext = TEMPO_STEP;
+	//phase of the next tick
+static uint16_t tempoLast = 0;
+	//sched_ms when the phase was last advanced
+
+static tempo_fn subscribers[TEMPO_MAX_SUBSCRIBERS];
+static uint8_t numSubscribers = 0;
+
+
+void tempo_subscribe(tempo_fn fn) {
+	if (numSubscribers < TEMPO_MAX_SUBSCRIBERS) {
+		subscribers[numSubscribers++] = fn;
+	}
+}
+
+
+/* Phase of tick k, TEMPO_BEAT for k=TEMPO_SUBDIV. Each pair of
+** ticks starts on an even tick; swing moves the odd one.
+*/
+static uint32_t tick_phase(uint8_t k) {
+
+	uint32_t phase = (uint32_t)(k >> 1) * (2*TEMPO_STEP);
+
+	if (k & 1) {
+		phase += (2*TEMPO_STEP/100) * tempo_swing;
+	}
+	return phase;
+}
+
+
+void tempo_step(void) {
+
+	uint8_t tick, i;
+
+	/* Advance by the ms since the last run, so that a run the
+	** scheduler drops or delays doesn't slow the clock
+	*/
+	tempoPhase += (uint32_t)tempo_bpm * (uint16_t)(sched_ms - tempoLast);
+	tempoLast = sched_ms;
+
+	/* A late run or a swing change may leave several ticks due */
+	while (tempoPhase >= tempoNext) {
+		tick = tempoTick;
+		if (tick == TEMPO_SUBDIV) {
+			tick = 0;
+			tempoPhase -= TEMPO_BEAT;
+			tempo_beats++;
+		}
+		tempoTick = tick + 1;
+		tempoNext = tick_phase(tempoTick);
+
+		for (i=0; i<numSubscribers; i++) {
+			subscribers[i](tick);
+		}
+	}
+}
+
+
+void tempo_set_bpm(uint16_t bpm) {
+
+	if (bpm < TEMPO_MIN) {
+		bpm = TEMPO_MIN;
+	} else if (bpm > TEMPO_MAX) {
+		bpm = TEMPO_MAX;
+	}
+	tempo_bpm = bpm;
+}
+
+
+void tempo_set_swing(uint8_t percent) {
+
+	if (percent < TEMPO_SWING_MIN) {
+		percent = TEMPO_SWING_MIN;
+	} else if (percent > TEMPO_SWING_MAX) {
+		percent = TEMPO_SWING_MAX;
+	}
+	tempo_swing = percent;
+	tempoNext = tick_phase(tempoTick);
+}
+
+
+uint8_t tempo_on_beat(void) {
+	return (tempoPhase < TEMPO_BEAT/10) || (tempoPhase >= TEMPO_BEAT - TEMPO_BEAT/10);
+}
+
+
+uint8_t tempo_nearest_tick(void) {
+	return ((tempoPhase + TEMPO_STEP/2) / TEMPO_STEP) % TEMPO_SUBDIV;
+}
+
+
+uint16_t tempo_beat_ms(void) {
+	return (TEMPO_BEAT + tempo_bpm/2) / tempo_bpm;
+}
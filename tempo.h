@@ -0,0 +1,65 @@
+/* tempo.h
+**
+** Beat clock. A phase accumulator advanced by the tempo in
+** hundredths of a BPM for each 1ms of sched_ms that passes, so
+** a late run catches up; a beat is TEMPO_BEAT phase
+** units (one minute, in the same units), so any tempo with two
+** decimals is exact and the beats never drift against the 1ms
+** timer however long it runs.
+**
+** Each beat is divided into TEMPO_SUBDIV ticks (sixteenths).
+** Swing delays every second tick: at 50% the ticks are even,
+** at 66% the pairs are played as triplets. Modules subscribe to
+** be told of each tick as it passes.
+*/
+
+#ifndef TEMPO_H
+#define TEMPO_H
+
+/* Tempo in hundredths of a BPM */
+#define TEMPO_DEFAULT 12000
+#define TEMPO_MIN 6000
+#define TEMPO_MAX 24000
+
+/* Swing in percent of a pair of ticks */
+#define TEMPO_SWING_MIN 50
+#define TEMPO_SWING_MAX 75
+
+#define TEMPO_SUBDIV 4
+#define TEMPO_BEAT 6000000UL
+#define TEMPO_STEP (TEMPO_BEAT/TEMPO_SUBDIV)
+
+#define TEMPO_MAX_SUBSCRIBERS 4
+
+/* Called with the tick number, 0 on the beat */
+typedef void (*tempo_fn)(uint8_t tick);
+
+extern volatile uint16_t tempo_bpm;
+extern volatile uint8_t tempo_swing;
+extern volatile uint32_t tempo_beats;
+	//beats since start
+
+/* Register a subscriber before interrupts are enabled */
+void tempo_subscribe(tempo_fn fn);
+
+/* Advance the clock by 1ms - a 1ms task */
+void tempo_step(void);
+
+/* Change the tempo (clamped to TEMPO_MIN..TEMPO_MAX). The beat
+** carries on from where it is.
+*/
+void tempo_set_bpm(uint16_t bpm);
+
+/* Change the swing (clamped to TEMPO_SWING_MIN..MAX) */
+void tempo_set_swing(uint8_t percent);
+
+/* Whether the clock is within a tenth of a beat of a beat */
+uint8_t tempo_on_beat(void);
+
+/* The tick nearest the current position (0..TEMPO_SUBDIV-1) */
+uint8_t tempo_nearest_tick(void);
+
+/* Length of a beat in ms, rounded */
+uint16_t tempo_beat_ms(void);
+
+#endif
@@ -1,24 +1,18 @@
 /* timer2.c
-** We setup timer2 to sample our push button regularly
-** and act on that.
+** We setup timer2 to clock the task scheduler every 1ms,
+** and act on the debounced push button events (keys.h).
 */
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
+#include "hal.h"
+#include "timer2.h"
 #include "notes.h"
-#include "d2a.h"
-#include "segment.h"
-#include "led.h"
 #include "serial.h"
 #include "playback.h"
-
-void quiet(void);
-
-/* Remember the last status of the push button
-** and 7SEG display
-*/
-volatile uint8_t prevButtonStatus = 0;
-volatile uint8_t cat = 0;
+#include "voice.h"
+#include "profile.h"
+#include "power.h"
+#include "sched.h"
+#include "keys.h"
 
 /* Set up timer 2 to generate an interrupt every 1ms. 
 ** We will divide the clock by 64 and count up to 124.
@@ -30,20 +24,14 @@ volatile uint8_t cat = 0;
 */
 void setup_timer2(void)
 {
-	/* Set the output compare value to be 124 */
-	OCR2 = 124;
-
-	/* Enable an interrupt on output compare match. 
-	** Note that interrupts have to be enabled globally
-	** before the interrupts will fire.
+	/* Set the output compare value to be 124, enable an
+	** interrupt on output compare match, and set the timer to
+	** clear on compare match (CTC mode) and to divide the clock
+	** by 64. This starts the timer running. Note that interrupts
+	** have to be enabled globally before the interrupts will
+	** fire.
 	*/
-	TIMSK |= (1<<OCIE2);
-
-	/* Set the timer to clear on compare match (CTC mode)
-	** and to divide the clock by 64. This starts the timer
-	** running.
-	*/
-	TCCR2 = (1<<WGM21)|(0<<WGM20)|(0<<CS22)|(1<<CS21)|(1<<CS20);
+	hal_tick_timer_setup();
 }
 
 
@@ -52,79 +40,88 @@ void pressNote(uint8_t n) {
 
 	/* set current note */
 	note = n;
-	/* set frequency (notes.h) */
-	start_note();
+	/* start a voice for it (voice.h) */
+	voice_note_on(n);
 	/* print out note (serial.h) */
 	output_note();	
 }
 
 
-/* Abstraction of record note action */
-void recNote(uint8_t n) {
+/* Abstraction of release note button actions */
+void releaseNote(uint8_t n, uint8_t held) {
+	
+	uint8_t i;
+	
+	/* free its voice (voice.h) */
+	voice_note_off(n);
+	
+	/* Keep displaying the lowest held note, if any */
+	if (note==n) {
+		note = 255;
+		for (i=0; i<=7; i++) {
+			if (held & (1<<i)) {
+				note = i;
+				break;
+			}
+		}
+	}
+}
+
+
+/* Abstraction of record note action: store the press or
+** release with the time in ms since the previous recorded
+** event (or the start of recording)
+*/
+void recNote(uint8_t n, uint8_t pressed, uint16_t time) {
 	if (recording==1) {
-		buffer_note(n, rec_timecounter);
-		rec_timecounter = 0;
+		record_note(n, pressed, time - rec_lasttime);
+		rec_lasttime = time;
 	}
 	
 }
 
 
-ISR(TIMER2_COMP_vect) 
+/* Buttons whose press was taken, as of the last event handled */
+static uint8_t keysTaken = 0;
+
+/* Key event consumer, run from the main loop. Presses start
+** a voice and releases free it, and both are recorded with
+** their own timestamps. Presses are ignored while the demo
+** tune or a recording plays back, unless overdubbing
+** (playback.h), and so are the releases of those presses.
+*/
+void handleKeyEvents(void)
 {
-	/* Sample push button connected to port A pin 0.
-	** (We ignore other push buttons.)
-	** If has changed since previous sample, we act on that,
-	** i.e. other stop note playing or start note playing
-	*/
-	uint8_t currentButtonStatus = PINA;
-	uint8_t i;
+	key_event_t ev;
+	uint8_t bit;
 	
-	/* Push Buttons
-	 ** Ensure the button state has changed,
-	 ** and the demo tune is inactive (notes.h) 
-	 */
-	if ((currentButtonStatus != prevButtonStatus) && (tuneWait == 0)) {
-		
-		/* Check no buttons held */
-		if (currentButtonStatus==0) {	
-			/* Disable the speaker */
-			quiet();
-			/* Set no note being played */
-			note = ~0;
-		}
-		/* A button was released */
-		else if (prevButtonStatus > currentButtonStatus) {
-			/* Play any held-down button */
-			for (i=0; i<=7; i++) {
-				if (currentButtonStatus & (1<<i)) {
-					pressNote(i);
-					recNote(i);
-					break;
-				}
-			}
-		}
-		/* A button was pressed */
-		else if (prevButtonStatus < currentButtonStatus) {
-			/* Play the new button */
-			for (i=0; i<=7; i++) {
-				if ((currentButtonStatus^prevButtonStatus) & (1<<i)) {
-					pressNote(i);
-					recNote(i);
-					break;
-				}
+	while (keys_pop(&ev)) {
+		bit = 1 << ev.key;
+		if (ev.pressed) {
+			if ((tuneWait == 255) || recording) {
+				keysTaken |= bit;
+				pressNote(ev.key);
+				recNote(ev.key, 1, ev.time);
 			}
+		} else if (keysTaken & bit) {
+			keysTaken &= ~bit;
+			releaseNote(ev.key, keysTaken);
+			recNote(ev.key, 0, ev.time);
 		}
 	}
-	/* Remember the status of the push button*/
-	prevButtonStatus = PINA;
-	
-	/* Print to the 7Seg Display */
-	segmentPrint(note,cat,octave);
-	cat ^= 1;
+}
+
 
-	/* Incrememnt the beat timer */
-	beatStep();
+ISR(TIMER2_COMP_vect) 
+{
+	/* Only advance the scheduler clock and mark tasks ready;
+	** the tasks themselves (button scan, display, beat,
+	** playback) run from the main loop (sched.h).
+	*/
+	POWER_WAKE();
+	PROF_ENTER(PROF_TIMER2);
+	
+	sched_tick();
 	
-	/* Run the playback tune handler */
-	playbackStep();
+	PROF_EXIT(PROF_TIMER2);
 }
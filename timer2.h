@@ -1,9 +1,10 @@
 /* timer2.h
 **
 ** We set up timer 2 to give us an interrupt
-** every 1 millisecond. Tasks that have to occur
-** regularly (every ms) can be added to the
-** interrupt handler (in timer2.c).
+** every 1 millisecond, which clocks the task
+** scheduler. Tasks that have to occur regularly
+** are registered with sched_add() (sched.h) and
+** run from the main loop.
 */
 
 #ifndef TIMER2_H
@@ -11,4 +12,11 @@
 
 void setup_timer2(void);
 
+/* Act on queued key events (keys.h) - main loop */
+void handleKeyEvents(void);
+
+/* Start/release the voice for a note, as a button would */
+void pressNote(uint8_t n);
+void releaseNote(uint8_t n, uint8_t held);
+
 #endif
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+"""gen_tuning.py
+
+Generate the tuning tables (tuning_table.c) for the synthesiser: the DDS
+phase increment of every MIDI key 0..127 at the audio sample rate,
+
+    inc = round(frequency * 65536 / AUDIO_SAMPLE_RATE)
+
+for equal temperament, then for just intonation on each of the 12
+tonics (C..B). Both are tuned from the given A4; just intonation
+keeps each tonic at its equal tempered pitch.
+
+The sample rate is read from notes.h so that it has one definition.
+
+Usage: gen_tuning.py [--a4 HZ] [--notes notes.h] -o tuning_table.c
+"""
+
+import argparse
+import os
+import re
+import sys
+
+# Just intonation ratios of the 12 degrees above the tonic
+JUST_RATIOS = [
+    (1, 1), (16, 15), (9, 8), (6, 5), (5, 4), (4, 3),
+    (45, 32), (3, 2), (8, 5), (5, 3), (9, 5), (15, 8),
+]
+
+KEYS = 128
+
+
+def equal_freq(key, a4):
+    return a4 * 2.0 ** ((key - 69) / 12.0)
+
+
+def just_freq(key, tonic, a4):
+    # The tonic nearest below the key, at its equal tempered pitch
+    degree = (key - tonic) % 12
+    base = key - degree
+    num, den = JUST_RATIOS[degree]
+    return equal_freq(base, a4) * num / den
+
+
+def sample_rate(path):
+    with open(path) as f:
+        m = re.search(r"#define\s+AUDIO_SAMPLE_RATE\s+(\d+)", f.read())
+    if not m:
+        sys.exit("%s: AUDIO_SAMPLE_RATE not found" % path)
+    return int(m.group(1))
+
+
+def phase_inc(freq, rate):
+    inc = int(round(freq * 65536 / rate))
+    if not 0 < inc < 65536:
+        sys.exit("%.2fHz is out of range at %dHz" % (freq, rate))
+    return inc
+
+
+def table(name, incs):
+    rows = []
+    for i in range(0, len(incs), 12):
+        rows.append("\t\t" + ", ".join("%5d" % v for v in incs[i:i + 12]))
+    return "\t{\t/* %s */\n%s\n\t}" % (name, ",\n".join(rows))
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    ap = argparse.ArgumentParser(description="Generate the tuning tables")
+    ap.add_argument("--a4", type=float, default=440.0, help="A4 in Hz (default 440)")
+    ap.add_argument("--notes", default=os.path.join(here, "..", "notes.h"),
+                    help="header defining AUDIO_SAMPLE_RATE")
+    ap.add_argument("-o", "--output", required=True)
+    args = ap.parse_args()
+
+    if not 400.0 <= args.a4 <= 480.0:
+        sys.exit("A4 must be 400..480Hz")
+    rate = sample_rate(args.notes)
+    names = ["C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"]
+
+    tables = [table("equal temperament",
+                    [phase_inc(equal_freq(k, args.a4), rate) for k in range(KEYS)])]
+    for tonic in range(12):
+        tables.append(table("just intonation on " + names[tonic],
+                            [phase_inc(just_freq(k, tonic, args.a4), rate)
+                             for k in range(KEYS)]))
+
+    out = []
+    out.append("/* tuning_table.c")
+    out.append("**")
+    out.append("** Generated by tools/gen_tuning.py - do not edit.")
+    out.append("** A4 = %gHz, %dHz sample rate." % (args.a4, rate))
+    out.append("*/")
+    out.append("")
+    out.append('#include "hal.h"')
+    out.append('#include "tuning.h"')
+    out.append("")
+    out.append("const uint32_t tuning_a4_mhz = %dUL;" % round(args.a4 * 1000))
+    out.append("")
+    out.append("const uint16_t tuningPhaseInc[TUNING_TABLES][TUNING_KEYS] PROGMEM = {")
+    out.append(",\n".join(tables))
+    out.append("};")
+    out.append("")
+
+    with open(args.output, "w") as f:
+        f.write("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()
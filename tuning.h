@@ -0,0 +1,24 @@
+/* tuning.h
+**
+** Tuning tables, generated at build time by tools/gen_tuning.py
+** into tuning_table.c: the phase increment of every MIDI key for
+** equal temperament (table 0) and for just intonation on each
+** tonic C..B (tables 1..12), tuned from A4 (440Hz unless the
+** build sets another).
+*/
+
+#ifndef TUNING_H
+#define TUNING_H
+
+#define TUNING_KEYS 128
+#define TUNING_TABLES 13
+
+#define TUNING_EQUAL 0
+#define TUNING_JUST 1
+
+/* A4 the tables were generated for, in mHz */
+extern const uint32_t tuning_a4_mhz;
+
+extern const uint16_t tuningPhaseInc[TUNING_TABLES][TUNING_KEYS] PROGMEM;
+
+#endif
@@ -0,0 +1,244 @@
+/* voice.c
+**
+** Polyphonic voice pool: allocation, retrigger and stealing.
+*/
+
+#include "hal.h"
+#include "audio.h"
+#include "notes.h"
+#include "voice.h"
+#include "wavetable.h"
+
+voice_t voices[NUM_VOICES];
+
+/* Incremented on every allocation. The voice whose stamp
+** is furthest behind is the oldest, which also holds across
+** the 8-bit wrap since only NUM_VOICES stamps are live.
+*/
+static uint8_t voiceClock = 0;
+
+/* Current MIDI pitch bend in 1/256 semitones */
+static int16_t voiceBend = 0;
+
+/* Envelope settings, and the level change per ms of each stage */
+volatile uint16_t env_attack = ENV_DEFAULT_ATTACK;
+volatile uint16_t env_decay = ENV_DEFAULT_DECAY;
+volatile uint8_t env_sustain = ENV_DEFAULT_SUSTAIN;
+volatile uint16_t env_release = ENV_DEFAULT_RELEASE;
+
+#define ENV_LEVEL(percent) ((uint16_t)((uint32_t)ENV_MAX * (percent) / 100))
+
+static uint16_t envAttackStep = ENV_MAX/ENV_DEFAULT_ATTACK;
+static uint16_t envDecayStep = (ENV_MAX - ENV_LEVEL(ENV_DEFAULT_SUSTAIN))/ENV_DEFAULT_DECAY;
+static uint16_t envSustainLevel = ENV_LEVEL(ENV_DEFAULT_SUSTAIN);
+static uint16_t envReleaseStep = ENV_MAX/ENV_DEFAULT_RELEASE;
+
+
+/* Step a voice's envelope by 1ms and update its amplitude */
+static void env_update(voice_t* v) {
+	
+	uint16_t level = v->level;
+	
+	switch (v->stage) {
+	case ENV_ATTACK:
+		if (level >= ENV_MAX - envAttackStep) {
+			level = ENV_MAX;
+			v->stage = ENV_DECAY;
+		} else {
+			level += envAttackStep;
+		}
+		break;
+	case ENV_DECAY:
+		if ((level <= envSustainLevel) || (level - envSustainLevel <= envDecayStep)) {
+			level = envSustainLevel;
+			v->stage = ENV_SUSTAIN;
+		} else {
+			level -= envDecayStep;
+		}
+		break;
+	case ENV_SUSTAIN:
+		/* Follows a change of the sustain setting */
+		level = envSustainLevel;
+		break;
+	case ENV_RELEASE:
+		if (level <= envReleaseStep) {
+			level = 0;
+			v->active = 0;
+		} else {
+			level -= envReleaseStep;
+		}
+		break;
+	}
+	v->level = level;
+	
+	/* Full level and full velocity give VOICE_GAIN_FULL */
+	v->amp = ((uint16_t)(level >> 8) * (v->gain + 1)) >> 8;
+}
+
+
+void voice_env_step(void) {
+	
+	uint8_t i;
+	
+	for (i=0; i<NUM_VOICES; i++) {
+		if (voices[i].active) {
+			env_update(&voices[i]);
+		}
+	}
+}
+
+
+void voice_set_env(uint16_t attack, uint16_t decay, uint8_t sustain, uint16_t release) {
+	
+	env_attack = attack;
+	env_decay = decay;
+	env_sustain = sustain;
+	env_release = release;
+	
+	/* A time of 0 takes one step */
+	envSustainLevel = ENV_LEVEL(sustain);
+	envAttackStep = attack ? ENV_MAX/attack : ENV_MAX;
+	envDecayStep = decay ? (ENV_MAX - envSustainLevel)/decay : ENV_MAX;
+	envReleaseStep = release ? ENV_MAX/release : ENV_MAX;
+	if (envDecayStep == 0) {
+		envDecayStep = 1;
+	}
+}
+
+
+/* Start the voice for note n (a button note or VOICE_MIDI|key) */
+static void voice_start(uint8_t n, uint16_t inc, uint8_t gain) {
+	
+	voice_t* v = 0;
+	uint8_t i, age, oldest = 0;
+	
+	/* Switch the audio path back on if it was silent */
+	audio_wake();
+	
+	/* Retrigger a voice already playing this note, else
+	** take a free one, else steal the oldest, preferring
+	** voices already released.
+	*/
+	for (i=0; i<NUM_VOICES; i++) {
+		if (voices[i].active && (voices[i].note==n)) {
+			v = &voices[i];
+			break;
+		}
+	}
+	if (v==0) {
+		for (i=0; i<NUM_VOICES; i++) {
+			if (!voices[i].active) {
+				v = &voices[i];
+				break;
+			}
+			age = (uint8_t)(voiceClock - voices[i].stamp) >> 1;
+			if (voices[i].stage == ENV_RELEASE) {
+				age |= 0x80;
+			}
+			if (age >= oldest) {
+				oldest = age;
+				v = &voices[i];
+			}
+		}
+	}
+	
+	/* A retriggered voice attacks from its current level */
+	if (!(v->active && (v->note==n))) {
+		v->level = 0;
+		v->phase = 0;
+	}
+	v->note = n;
+	v->inc = inc;
+	v->gain = gain;
+	v->stamp = voiceClock++;
+	v->stage = ENV_ATTACK;
+	v->active = 1;
+	env_update(v);
+	
+	/* Pick up any change to triWaveSteps */
+	wavetable_refresh();
+}
+
+
+void voice_note_on(uint8_t n) {
+	
+	if (n>7) {
+		return;
+	}
+	voice_start(n, note_phase_inc(n), VOICE_GAIN_FULL);
+}
+
+
+void voice_midi_on(uint8_t key, uint8_t velocity) {
+	
+	/* Velocity 127 is unity gain */
+	voice_start(VOICE_MIDI | (key & 0x7F), midi_phase_inc(key, voiceBend),
+		(velocity << 1) | 1);
+}
+
+
+void voice_midi_off(uint8_t key) {
+	voice_note_off(VOICE_MIDI | (key & 0x7F));
+}
+
+
+void voice_midi_bend(int16_t bend) {
+	
+	uint8_t i;
+	uint16_t inc;
+	
+	/* +-8192 is +-2 semitones, i.e. +-512/256 */
+	voiceBend = bend / 16;
+	
+	for (i=0; i<NUM_VOICES; i++) {
+		if (voices[i].active && (voices[i].note & VOICE_MIDI)) {
+			inc = midi_phase_inc(voices[i].note & 0x7F, voiceBend);
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				voices[i].inc = inc;
+			}
+		}
+	}
+}
+
+
+void voice_note_off(uint8_t n) {
+	
+	uint8_t i;
+	
+	for (i=0; i<NUM_VOICES; i++) {
+		if (voices[i].active && (voices[i].note==n)) {
+			voices[i].stage = ENV_RELEASE;
+		}
+	}
+}
+
+
+void voice_release_all(void) {
+	
+	uint8_t i;
+	
+	for (i=0; i<NUM_VOICES; i++) {
+		voices[i].stage = ENV_RELEASE;
+	}
+}
+
+
+void voice_all_off(void) {
+	
+	uint8_t i;
+	
+	for (i=0; i<NUM_VOICES; i++) {
+		voices[i].active = 0;
+	}
+}
+
+
+uint8_t voice_count(void) {
+	
+	uint8_t i, count = 0;
+	
+	for (i=0; i<NUM_VOICES; i++) {
+		count += voices[i].active;
+	}
+	return count;
+}
@@ -0,0 +1,99 @@
+/* voice.h
+**
+** Polyphonic voice pool. Each held note owns one voice with
+** its own phase accumulator; the voices are rendered and
+** summed by synth_render (notes.c). When more notes are held than
+** there are voices, the oldest voice is stolen.
+**
+** Button notes (0..7) and MIDI keys (VOICE_MIDI|key) share the
+** pool. MIDI voices carry a velocity gain and follow pitch bend.
+**
+** Each voice has an ADSR envelope, stepped every 1ms by
+** voice_env_step. A released voice sounds until its release
+** ends. The envelope level and velocity are combined into one
+** 8-bit amplitude at that control rate, so rendering only
+** multiplies each sample by it.
+*/
+
+#ifndef VOICE_H
+#define VOICE_H
+
+#define NUM_VOICES 4
+
+/* Flag in voice_t.note marking a MIDI key */
+#define VOICE_MIDI 0x80
+
+/* Unity gain; anything lower is scaled by gain/256 */
+#define VOICE_GAIN_FULL 255
+
+/* Envelope stages */
+#define ENV_ATTACK 0
+#define ENV_DECAY 1
+#define ENV_SUSTAIN 2
+#define ENV_RELEASE 3
+
+#define ENV_MAX 0xFFFF
+
+/* Envelope times in ms, for a change over the full level;
+** sustain in percent
+*/
+#define ENV_DEFAULT_ATTACK 5
+#define ENV_DEFAULT_DECAY 50
+#define ENV_DEFAULT_SUSTAIN 80
+#define ENV_DEFAULT_RELEASE 50
+#define ENV_MAX_MS 5000
+
+typedef struct {
+	uint8_t active;
+	uint8_t note;		//0..7, or VOICE_MIDI|key
+	uint8_t stamp;		//allocation order, for stealing
+	uint8_t gain;		//velocity
+	uint8_t amp;		//gain times envelope, applied by synth_render
+	uint8_t stage;
+	uint16_t level;		//envelope, 0..ENV_MAX
+	uint16_t phase;
+	uint16_t inc;
+} voice_t;
+
+extern volatile uint16_t env_attack;
+extern volatile uint16_t env_decay;
+extern volatile uint8_t env_sustain;
+extern volatile uint16_t env_release;
+
+/* Voice state is changed from the main loop (keys, commands,
+** playback, MIDI) and rendered from it too, so no handler
+** needs to lock it.
+*/
+extern voice_t voices[NUM_VOICES];
+
+/* Start note n on a free (or the oldest) voice */
+void voice_note_on(uint8_t n);
+
+/* Release the voice playing note n */
+void voice_note_off(uint8_t n);
+
+/* Start/release MIDI key 0..127 with velocity 1..127 */
+void voice_midi_on(uint8_t key, uint8_t velocity);
+void voice_midi_off(uint8_t key);
+
+/* Bend every MIDI voice, -8192..8191 for -2..+2 semitones */
+void voice_midi_bend(int16_t bend);
+
+/* Release every voice */
+void voice_release_all(void);
+
+/* Stop every voice at once, without a release */
+void voice_all_off(void);
+
+/* Advance the envelopes by 1ms - a 1ms task */
+void voice_env_step(void);
+
+/* Set the envelope for every voice: attack, decay and release
+** in ms (up to ENV_MAX_MS), sustain in percent
+*/
+void voice_set_env(uint16_t attack, uint16_t decay, uint8_t sustain, uint16_t release);
+
+/* Number of voices currently sounding */
+uint8_t voice_count(void);
+
+#endif
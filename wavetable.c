@@ -0,0 +1,191 @@
+/* wavetable.c
+**
+** Waveform lookup tables. The flash tables below were
+** generated offline; to add a user table, append it here,
+** give it a WAVE_ number in wavetable.h and add it to
+** waveTables[] and waveNames[].
+*/
+
+#include "hal.h"
+#include "notes.h"
+#include "wavetable.h"
+
+uint8_t waveTable[WAVETABLE_SIZE];
+volatile uint8_t waveInterpolate = 0;
+
+/* Step count the triangle in waveTable was built with,
+** 0 if waveTable holds another waveform
+*/
+static uint8_t triSteps = 0;
+
+/* Sine */
+static const uint8_t waveSine[WAVETABLE_SIZE] PROGMEM = {
+	128,131,134,137,140,144,147,150,153,156,159,162,165,168,171,174,
+	177,179,182,185,188,191,193,196,199,201,204,206,209,211,213,216,
+	218,220,222,224,226,228,230,232,234,235,237,239,240,241,243,244,
+	245,246,248,249,250,250,251,252,253,253,254,254,254,255,255,255,
+	255,255,255,255,254,254,254,253,253,252,251,250,250,249,248,246,
+	245,244,243,241,240,239,237,235,234,232,230,228,226,224,222,220,
+	218,216,213,211,209,206,204,201,199,196,193,191,188,185,182,179,
+	177,174,171,168,165,162,159,156,153,150,147,144,140,137,134,131,
+	128,125,122,119,116,112,109,106,103,100,97,94,91,88,85,82,
+	79,77,74,71,68,65,63,60,57,55,52,50,47,45,43,40,
+	38,36,34,32,30,28,26,24,22,21,19,17,16,15,13,12,
+	11,10,8,7,6,6,5,4,3,3,2,2,2,1,1,1,
+	1,1,1,1,2,2,2,3,3,4,5,6,6,7,8,10,
+	11,12,13,15,16,17,19,21,22,24,26,28,30,32,34,36,
+	38,40,43,45,47,50,52,55,57,60,63,65,68,71,74,77,
+	79,82,85,88,91,94,97,100,103,106,109,112,116,119,122,125
+};
+
+/* Square, band-limited to harmonics 1,3,5,7 (sigma
+** approximated to tame the Gibbs overshoot) */
+static const uint8_t waveSquare[WAVETABLE_SIZE] PROGMEM = {
+	127,137,146,155,163,172,180,188,196,203,210,216,222,227,232,236,
+	239,243,246,248,250,251,253,254,254,255,255,255,255,255,255,254,
+	254,254,253,253,253,253,252,252,252,252,252,252,253,253,253,253,
+	253,253,253,254,254,254,254,254,254,254,254,254,254,254,254,254,
+	254,254,254,254,254,254,254,254,254,254,254,254,254,254,253,253,
+	253,253,253,253,253,252,252,252,252,252,252,253,253,253,253,254,
+	254,254,255,255,255,255,255,255,254,254,253,251,250,248,246,243,
+	239,236,232,227,222,216,210,203,196,188,180,172,163,155,146,137,
+	128,118,109,100,92,83,75,67,59,52,45,39,33,28,23,19,
+	16,12,9,7,5,4,2,1,1,0,0,0,0,0,0,1,
+	1,1,2,2,2,2,3,3,3,3,3,3,2,2,2,2,
+	2,2,2,1,1,1,1,1,1,1,1,1,1,1,1,1,
+	1,1,1,1,1,1,1,1,1,1,1,1,1,1,2,2,
+	2,2,2,2,2,3,3,3,3,3,3,2,2,2,2,1,
+	1,1,0,0,0,0,0,0,1,1,2,4,5,7,9,12,
+	16,19,23,28,33,39,45,52,59,67,75,83,92,100,109,118
+};
+
+/* Rising sawtooth, band-limited to harmonics 1..7 */
+static const uint8_t waveSaw[WAVETABLE_SIZE] PROGMEM = {
+	128,118,108,98,88,79,70,62,54,46,39,33,27,21,17,13,
+	9,6,4,2,1,0,0,0,0,1,2,3,5,6,8,10,
+	11,13,15,16,18,19,21,22,23,24,26,27,28,29,30,31,
+	31,32,33,34,35,36,37,38,39,41,42,43,44,46,47,48,
+	49,51,52,53,55,56,57,59,60,61,62,63,64,65,67,68,
+	69,70,71,72,73,74,75,77,78,79,80,82,83,84,85,87,
+	88,89,91,92,93,95,96,97,98,99,101,102,103,104,105,107,
+	108,109,110,111,112,114,115,116,117,118,120,121,122,124,125,126,
+	128,129,130,131,133,134,135,137,138,139,140,141,143,144,145,146,
+	147,148,150,151,152,153,154,156,157,158,159,160,162,163,164,166,
+	167,168,170,171,172,173,175,176,177,178,180,181,182,183,184,185,
+	186,187,188,190,191,192,193,194,195,196,198,199,200,202,203,204,
+	206,207,208,209,211,212,213,214,216,217,218,219,220,221,222,223,
+	224,224,225,226,227,228,229,231,232,233,234,236,237,239,240,242,
+	244,245,247,249,250,252,253,254,255,255,255,255,254,253,251,249,
+	246,242,238,234,228,222,216,209,201,193,185,176,167,157,147,137
+};
+
+/* User table: organ-like additive mix of harmonics
+** 1,2,3,4,6,8 */
+static const uint8_t waveOrgan[WAVETABLE_SIZE] PROGMEM = {
+	128,140,152,164,175,186,196,206,214,222,229,235,240,245,248,251,
+	253,254,255,255,255,254,254,253,252,251,250,249,248,247,247,246,
+	245,245,244,243,242,241,240,238,236,234,232,229,226,223,220,217,
+	213,210,206,203,200,196,193,191,188,186,184,182,180,179,178,177,
+	177,176,176,175,175,174,174,174,173,172,172,171,170,170,169,168,
+	168,167,167,166,166,166,167,167,167,168,169,170,170,171,171,172,
+	172,171,171,170,168,166,164,161,158,155,151,147,142,138,134,129,
+	125,121,118,115,113,111,109,109,109,110,111,113,115,118,121,124,
+	127,131,134,137,140,142,144,145,146,146,146,144,142,140,137,134,
+	130,126,121,117,113,108,104,100,97,94,91,89,87,85,84,84,
+	83,83,84,84,85,85,86,87,88,88,88,89,89,89,88,88,
+	87,87,86,85,85,84,83,83,82,81,81,81,80,80,79,79,
+	78,78,77,76,75,73,71,69,67,64,62,59,55,52,49,45,
+	42,38,35,32,29,26,23,21,19,17,15,14,13,12,11,10,
+	10,9,8,8,7,6,5,4,3,2,1,1,0,0,0,1,
+	2,4,7,10,15,20,26,33,41,49,59,69,80,91,103,115
+};
+
+/* Flash tables by waveform number. The triangle is built
+** at runtime as it depends on triWaveSteps.
+*/
+static const uint8_t* const waveTables[NUM_WAVES] PROGMEM = {
+	waveSquare, 0, waveSine, waveSaw, waveOrgan
+};
+
+static const char waveSquareName[] PROGMEM = "Square";
+static const char waveTriangleName[] PROGMEM = "Triangle";
+static const char waveSineName[] PROGMEM = "Sine";
+static const char waveSawName[] PROGMEM = "Saw";
+static const char waveOrganName[] PROGMEM = "Organ";
+
+static PGM_P const waveNames[NUM_WAVES] PROGMEM = {
+	waveSquareName, waveTriangleName, waveSineName, waveSawName,
+	waveOrganName
+};
+
+
+/* Build a triangle with triWaveSteps levels rising over the
+** first half period and falling over the second. A fixed-point
+** ramp avoids a division per level, as this runs from the main
+** loop when a voice starts (wavetable_refresh) and holds up the
+** rendering meanwhile.
+*/
+static void build_triangle(void)
+{
+	uint8_t levels[32];
+	uint8_t i, steps = triWaveSteps;
+	uint16_t level = 0;
+	uint16_t step = (255u<<8)/(steps-1);
+	
+	for (i=0; i<steps; i++) {
+		levels[i] = level>>8;
+		levels[2*steps-1-i] = level>>8;
+		level += step;
+	}
+	levels[steps-1] = 255;
+	levels[steps] = 255;
+	
+	/* Spread the 2*steps levels over the whole period */
+	i = 0;
+	do {
+		waveTable[i] = levels[((uint16_t)i*steps) >> 7];
+	} while (++i != 0);
+	
+	triSteps = steps;
+}
+
+
+void wavetable_select(uint8_t wave) {
+	
+	const uint8_t* table;
+	uint8_t i;
+	
+	if (wave>=NUM_WAVES) {
+		wave = WAVE_SQUARE;
+	}
+	
+	if (wave==WAVE_TRIANGLE) {
+		build_triangle();
+		return;
+	}
+	
+	/* Copy from flash */
+	table = (const uint8_t*)pgm_read_ptr(&waveTables[wave]);
+	i = 0;
+	do {
+		waveTable[i] = pgm_read_byte(&table[i]);
+	} while (++i != 0);
+	triSteps = 0;
+}
+
+
+void wavetable_refresh(void) {
+	
+	if ((triSteps != 0) && (triSteps != triWaveSteps)) {
+		build_triangle();
+	}
+}
+
+
+PGM_P wavetable_name(uint8_t wave) {
+	
+	if (wave>=NUM_WAVES) {
+		return PSTR("");
+	}
+	return (PGM_P)pgm_read_ptr(&waveNames[wave]);
+}
@@ -0,0 +1,40 @@
+/* wavetable.h
+**
+** Waveform lookup tables. Every waveform is a 256-entry table
+** indexed by the top byte of a voice's phase accumulator.
+** The fixed tables live in flash (PROGMEM); the selected one
+** is copied into waveTable in SRAM, which is what the mixer
+** reads, so all waveforms share one lookup path.
+*/
+
+#ifndef WAVETABLE_H
+#define WAVETABLE_H
+
+#define WAVETABLE_SIZE 256
+
+/* Waveform numbers, as stored in the "waveform" global */
+#define WAVE_SQUARE 0
+#define WAVE_TRIANGLE 1
+#define WAVE_SINE 2
+#define WAVE_SAW 3
+#define WAVE_ORGAN 4	//user table
+#define NUM_WAVES 5
+
+/* The active table, and whether to interpolate between
+** neighbouring entries using the low byte of the phase
+*/
+extern uint8_t waveTable[WAVETABLE_SIZE];
+extern volatile uint8_t waveInterpolate;
+
+/* Load waveform "wave" into the active table */
+void wavetable_select(uint8_t wave);
+
+/* Rebuild the active table if it is the triangle and
+** triWaveSteps has changed since it was built
+*/
+void wavetable_refresh(void);
+
+/* Name of a waveform, for printing */
+PGM_P wavetable_name(uint8_t wave);
+
+#endif